@@ -0,0 +1,280 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// microbenchmarks for the string and MIME type helpers that run on
+// every offered type and every invocation; run with meson benchmark,
+// or directly with an optional mime.types file to benchmark against
+
+#include "boilerplate.h"
+
+#include <inttypes.h>
+
+// how long to keep running each benchmark for
+#define TARGET_TIME_NS (200 * 1000 * 1000ull)
+
+static uint64_t allocations = 0;
+
+#ifdef __GLIBC__
+// count the allocations by wrapping the glibc allocator,
+// which all of its own functions also go through
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+#    define COUNTS_ALLOCATIONS 1
+#else
+#    define COUNTS_ALLOCATIONS 0
+#endif
+
+// what Firefox offers when copying from a web page
+static const char *browser_types[] = {
+    "text/html",
+    "text/_moz_htmlcontext",
+    "text/_moz_htmlinfo",
+    "text/x-moz-url-priv",
+    "text/plain;charset=utf-8",
+    "text/plain",
+    "UTF8_STRING",
+    "COMPOUND_TEXT",
+    "TEXT",
+    "STRING",
+    "chromium/x-source-url"
+};
+
+// what LibreOffice offers when copying from a spreadsheet
+static const char *office_types[] = {
+    "application/x-openoffice-embed-source-xml;"
+        "windows_formatname=\"Star Embed Source (XML)\"",
+    "application/x-openoffice-objectdescriptor-xml;"
+        "windows_formatname=\"Star Object Descriptor (XML)\";"
+        "classname=\"47BBB4CB-CE4C-4E80-A591-42D9AE74950F\";"
+        "typename=\"calc8\";displayname=\"\";viewaspect=\"1\";"
+        "width=\"4516\";height=\"452\";posx=\"0\";posy=\"0\"",
+    "application/x-openoffice-gdimetafile;"
+        "windows_formatname=\"GDIMetaFile\"",
+    "application/x-openoffice-emf;windows_formatname=\"Image EMF\"",
+    "application/x-openoffice-wmf;windows_formatname=\"Image WMF\"",
+    "image/png",
+    "image/bmp",
+    "text/html",
+    "application/x-libreoffice-tsvc",
+    "text/rtf",
+    "text/richtext",
+    "application/x-openoffice-link;windows_formatname=\"Link\"",
+    "application/x-openoffice-dif;windows_formatname=\"DIF\"",
+    "text/plain;charset=utf-8",
+    "UTF8_STRING",
+    "STRING",
+    "TEXT"
+};
+
+static const char *paths[] = {
+    "/home/user/Pictures/screenshot-2024-01-01.png",
+    "/home/user/Documents/report.final.odt",
+    "/tmp/wl-copy-buffer-AbCdEf/stdin",
+    "notes.txt",
+    "archive.tar.gz",
+    "/usr/share/doc/README"
+};
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+// keeps the compiler from optimizing the work away
+static volatile uintptr_t sink;
+
+struct list {
+    const char **items;
+    size_t count;
+};
+
+static void run_is_text(void *data, uint64_t iterations) {
+    struct list *list = data;
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += mime_type_is_text(list->items[i % list->count]);
+    }
+}
+
+static void run_has_prefix(void *data, uint64_t iterations) {
+    struct list *list = data;
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += str_has_prefix(list->items[i % list->count], "text/");
+    }
+}
+
+static void run_has_suffix(void *data, uint64_t iterations) {
+    struct list *list = data;
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += str_has_suffix(list->items[i % list->count], "+xml");
+    }
+}
+
+static void run_get_extension(void *data, uint64_t iterations) {
+    struct list *list = data;
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += (uintptr_t) get_file_extension(list->items[i % list->count]);
+    }
+}
+
+static void run_infer_from_name(void *data, uint64_t iterations) {
+    const char *path = data;
+    for (uint64_t i = 0; i < iterations; i++) {
+        char *mime_type = infer_mime_type_from_name(path);
+        sink += (uintptr_t) mime_type;
+        free(mime_type);
+    }
+}
+
+struct table {
+    char *contents;
+    size_t size;
+    const char *extension;
+};
+
+static void run_table_lookup(void *data, uint64_t iterations) {
+    struct table *table = data;
+    for (uint64_t i = 0; i < iterations; i++) {
+        FILE *f = fmemopen(table->contents, table->size, "r");
+        char *mime_type = find_mime_type_for_extension(f, table->extension);
+        fclose(f);
+        sink += (uintptr_t) mime_type;
+        free(mime_type);
+    }
+}
+
+// grows the iteration count until a run takes long enough to time
+static void bench
+(
+    const char *name,
+    void (*run)(void *data, uint64_t iterations),
+    void *data,
+    uint64_t ops_per_iteration
+) {
+    uint64_t iterations = 1;
+    uint64_t elapsed, allocated;
+    while (1) {
+        allocated = allocations;
+        uint64_t start = stats_now();
+        run(data, iterations);
+        elapsed = stats_now() - start;
+        allocated = allocations - allocated;
+        if (elapsed >= TARGET_TIME_NS) {
+            break;
+        }
+        iterations *= elapsed < TARGET_TIME_NS / 100 ? 100 : 2;
+    }
+    double ops = (double) iterations * ops_per_iteration;
+    printf("%-40s %12.1f ns/op", name, elapsed / ops);
+    if (COUNTS_ALLOCATIONS) {
+        printf(" %10.2f allocs/op", allocated / ops);
+    }
+    printf(" %14" PRIu64 " ops\n", (uint64_t) ops);
+}
+
+// a mime.types file as large as a full distribution one and then some;
+// the extensions being looked up are near the end of it
+static struct table generate_table(size_t lines, const char *extension) {
+    struct table table = { NULL, 0, extension };
+    FILE *f = open_memstream(&table.contents, &table.size);
+    fprintf(f, "# generated for benchmarking\n\n");
+    for (size_t i = 0; i < lines; i++) {
+        fprintf(
+            f,
+            "application/x-generated-type-%zu\t\tgen%zu g%zux gx%zu\n",
+            i, i, i, i
+        );
+    }
+    fprintf(f, "image/png\t\t\t\tpng\n");
+    fclose(f);
+    return table;
+}
+
+int main(int argc, char *argv[]) {
+    struct list browser = { browser_types, COUNT(browser_types) };
+    struct list office = { office_types, COUNT(office_types) };
+    struct list path_list = { paths, COUNT(paths) };
+
+    bench("mime_type_is_text/browser", run_is_text, &browser, 1);
+    bench("mime_type_is_text/office", run_is_text, &office, 1);
+    bench("str_has_prefix/browser", run_has_prefix, &browser, 1);
+    bench("str_has_prefix/office", run_has_prefix, &office, 1);
+    bench("str_has_suffix/browser", run_has_suffix, &browser, 1);
+    bench("str_has_suffix/office", run_has_suffix, &office, 1);
+    bench("get_file_extension", run_get_extension, &path_list, 1);
+
+    // goes through the system mime.types
+    bench(
+        "infer_mime_type_from_name/png",
+        run_infer_from_name,
+        "/home/user/Pictures/screenshot.png",
+        1
+    );
+    bench(
+        "infer_mime_type_from_name/miss",
+        run_infer_from_name,
+        "/home/user/file.no-such-extension",
+        1
+    );
+
+    struct table small = generate_table(1000, "png");
+    struct table large = generate_table(50000, "png");
+    struct table missing = generate_table(50000, "no-such-extension");
+    bench("find_mime_type/1k-lines", run_table_lookup, &small, 1);
+    bench("find_mime_type/50k-lines", run_table_lookup, &large, 1);
+    bench("find_mime_type/50k-lines-miss", run_table_lookup, &missing, 1);
+    free(small.contents);
+    free(large.contents);
+    free(missing.contents);
+
+    // and any given mime.types files, looking up an extension
+    // that's rarely there to measure a full scan
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "r");
+        if (f == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        struct table table = { NULL, 0, "no-such-extension" };
+        FILE *copy = open_memstream(&table.contents, &table.size);
+        char buffer[64 * 1024];
+        size_t got;
+        while ((got = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+            fwrite(buffer, 1, got, copy);
+        }
+        fclose(copy);
+        fclose(f);
+        char name[80];
+        snprintf(name, sizeof(name), "find_mime_type/%s", basename(argv[i]));
+        bench(name, run_table_lookup, &table, 1);
+        free(table.contents);
+    }
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+# wl-clipboard
+#
+# Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""
+Measures per-invocation latency of wl-copy through the compositor
+WAYLAND_DISPLAY points to: the time from starting wl-copy until it has set
+the selection and exited, the time it reports itself with --stats, and the
+time until wl-paste sees the new content. Prints one JSON object with the
+p50 and p99 of each for every protocol path.
+"""
+
+import argparse
+import json
+import math
+import os
+import subprocess
+import sys
+import time
+
+PATHS = [
+    ('data-control', {}),
+    ('popup', {'WL_CLIPBOARD_NO_DATA_CONTROL': '1'}),
+]
+CLIPBOARDS = [
+    ('regular', []),
+    ('primary', ['--primary']),
+]
+PASTE_ATTEMPTS = 1000
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[max(0, math.ceil(p * len(values)) - 1)]
+
+
+def copy_once(args, env, flags, token):
+    stats_read, stats_write = os.pipe()
+    env = dict(env, WL_CLIPBOARD_STATS='fd:{}'.format(stats_write))
+    start = time.monotonic_ns()
+    result = subprocess.run(
+        [args.wl_copy] + flags + [token],
+        env=env, pass_fds=[stats_write], stderr=subprocess.DEVNULL
+    )
+    startup = time.monotonic_ns() - start
+    os.close(stats_write)
+    with os.fdopen(stats_read) as stats:
+        # the first report is the one about setting the selection
+        report = stats.readline()
+    if result.returncode != 0 or not report:
+        return None
+    selection = json.loads(report)['phases'].get('selection')
+
+    for _ in range(PASTE_ATTEMPTS):
+        pasted = subprocess.run(
+            [args.wl_paste, '--no-newline'] + flags,
+            env=env, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL
+        )
+        if pasted.stdout == token.encode():
+            break
+    else:
+        sys.exit('wl-paste never saw the copied text')
+    propagation = time.monotonic_ns() - start
+    return startup // 1000, selection, propagation // 1000
+
+
+def run_path(args, path, env, clipboard, flags):
+    env = dict(os.environ, **env)
+    startup, selection, propagation = [], [], []
+    for i in range(args.runs):
+        token = 'wl-clipboard-bench-{}-{}'.format(os.getpid(), i)
+        sample = copy_once(args, env, flags, token)
+        if sample is None:
+            # this compositor does not support the path
+            return None
+        startup.append(sample[0])
+        if sample[1] is not None:
+            selection.append(sample[1])
+        propagation.append(sample[2])
+    subprocess.run(
+        [args.wl_copy, '--clear'] + flags,
+        env=env, stderr=subprocess.DEVNULL
+    )
+
+    result = {'path': path, 'clipboard': clipboard, 'runs': args.runs}
+    for name, values in [
+        ('startup', startup),
+        ('selection', selection),
+        ('propagation', propagation),
+    ]:
+        if values:
+            result[name + '_us_p50'] = percentile(values, 0.5)
+            result[name + '_us_p99'] = percentile(values, 0.99)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('wl_copy')
+    parser.add_argument('wl_paste')
+    parser.add_argument(
+        '--runs', type=int, default=int(os.environ.get('BENCH_RUNS', '100')),
+        help='number of copies to time for each path'
+    )
+    args = parser.parse_args()
+
+    if 'WAYLAND_DISPLAY' not in os.environ:
+        print('WAYLAND_DISPLAY is not set, skipping', file=sys.stderr)
+        sys.exit(77)
+
+    for path, env in PATHS:
+        for clipboard, flags in CLIPBOARDS:
+            result = run_path(args, path, env, clipboard, flags)
+            if result is not None:
+                print(json.dumps(result))
+                sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+# wl-clipboard
+#
+# Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""
+Records the --stats report of a wl-copy or wl-paste invocation along with
+its command line, and replays recorded invocations later, comparing the
+phase and transfer times they report now with the recorded ones. This turns
+a captured slow session into a repeatable benchmark case.
+
+    bench-replay.py record session.jsonl -- wl-copy --type text/html < page
+    bench-replay.py replay session.jsonl --wl-copy build/src/wl-copy
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+
+def run(argv, stdin_path, stdout=None):
+    stats_read, stats_write = os.pipe()
+    env = dict(os.environ, WL_CLIPBOARD_STATS='fd:{}'.format(stats_write))
+    stdin = open(stdin_path, 'rb') if stdin_path is not None else None
+    try:
+        process = subprocess.Popen(
+            argv, stdin=stdin, stdout=stdout,
+            env=env, pass_fds=[stats_write]
+        )
+    finally:
+        if stdin is not None:
+            stdin.close()
+    os.close(stats_write)
+    with os.fdopen(stats_read) as stats:
+        # wl-copy keeps reporting every transfer it serves from
+        # the background, the first report is the one we want
+        report = stats.readline()
+    if process.wait() != 0 or not report:
+        sys.exit('{} failed'.format(' '.join(argv)))
+    return json.loads(report)
+
+
+def record(args):
+    stdin_path = args.stdin
+    if stdin_path is not None:
+        stdin_path = os.path.abspath(stdin_path)
+    stats = run(args.command, stdin_path)
+    entry = {'argv': args.command, 'stdin': stdin_path, 'stats': stats}
+    with open(args.file, 'a') as f:
+        f.write(json.dumps(entry) + '\n')
+
+
+def timings(stats):
+    result = dict(stats['phases'])
+    for transfer in stats['transfers']:
+        result['transfer ' + transfer['type']] = transfer['duration_us']
+    return result
+
+
+def median(values):
+    values = sorted(values)
+    return values[len(values) // 2]
+
+
+def replay(args):
+    programs = {'wl-copy': args.wl_copy, 'wl-paste': args.wl_paste}
+    regressed = False
+    with open(args.file) as f:
+        entries = [json.loads(line) for line in f if line.strip()]
+    for number, entry in enumerate(entries):
+        argv = list(entry['argv'])
+        program = programs.get(os.path.basename(argv[0]))
+        if program is not None:
+            argv[0] = program
+        samples = {}
+        for _ in range(args.runs):
+            stats = run(argv, entry['stdin'], subprocess.DEVNULL)
+            for name, time in timings(stats).items():
+                samples.setdefault(name, []).append(time)
+        recorded = timings(entry['stats'])
+        for name, values in samples.items():
+            result = {
+                'entry': number,
+                'program': entry['stats']['program'],
+                'timing': name,
+                'recorded_us': recorded.get(name),
+                'replayed_us_p50': median(values),
+            }
+            if recorded.get(name):
+                ratio = result['replayed_us_p50'] / recorded[name]
+                result['ratio'] = round(ratio, 3)
+                if args.tolerance is not None and ratio > args.tolerance:
+                    regressed = True
+            print(json.dumps(result))
+    if regressed:
+        sys.exit(1)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter
+    )
+    commands = parser.add_subparsers(dest='action', required=True)
+
+    parser_record = commands.add_parser(
+        'record', help='run a command and record its stats'
+    )
+    parser_record.add_argument('file')
+    parser_record.add_argument(
+        '--stdin', help='file to feed the command, now and on replay'
+    )
+    parser_record.add_argument(
+        'command', nargs='+', help='the command to record, after --'
+    )
+
+    parser_replay = commands.add_parser(
+        'replay', help='run the recorded commands again and compare'
+    )
+    parser_replay.add_argument('file')
+    parser_replay.add_argument('--runs', type=int, default=10)
+    parser_replay.add_argument(
+        '--tolerance', type=float,
+        help='fail if a timing gets slower than this many times the recorded'
+    )
+    parser_replay.add_argument('--wl-copy', help='wl-copy to replay with')
+    parser_replay.add_argument('--wl-paste', help='wl-paste to replay with')
+
+    args = parser.parse_args()
+    if args.action == 'record':
+        record(args)
+    else:
+        replay(args)
+
+
+if __name__ == '__main__':
+    main()
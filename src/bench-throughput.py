@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+# wl-clipboard
+#
+# Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""
+Measures transfer throughput between wl-copy and wl-paste through the
+compositor WAYLAND_DISPLAY points to, using the numbers both tools report
+with --stats. Prints one JSON object per payload size and reader count.
+"""
+
+import argparse
+import json
+import os
+import resource
+import subprocess
+import sys
+import tempfile
+import time
+
+MIME_TYPE = 'application/octet-stream'
+SUFFIXES = {'K': 1 << 10, 'M': 1 << 20, 'G': 1 << 30}
+
+
+def parse_size(text):
+    text = text.strip().upper()
+    if text[-1:] in SUFFIXES:
+        return int(text[:-1]) * SUFFIXES[text[-1]]
+    return int(text)
+
+
+def make_payload(directory, size):
+    path = os.path.join(directory, 'payload-{}'.format(size))
+    block = os.urandom(1 << 20)
+    with open(path, 'wb') as f:
+        left = size
+        while left > 0:
+            f.write(block[:left])
+            left -= len(block)
+    return path
+
+
+def cpu_seconds(pid):
+    # utime and stime, in clock ticks, come after the parenthesized comm
+    try:
+        with open('/proc/{}/stat'.format(pid)) as f:
+            fields = f.read().rsplit(')', 1)[1].split()
+    except OSError:
+        return None
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+
+def stats_environment(fd):
+    env = dict(os.environ)
+    env['WL_CLIPBOARD_STATS'] = 'fd:{}'.format(fd)
+    return env
+
+
+def transfer_rates(report):
+    transfers = json.loads(report)['transfers']
+    return [transfer['mb_per_s'] for transfer in transfers]
+
+
+def run_case(args, payload, size, readers):
+    stats_read, stats_write = os.pipe()
+    with open(payload, 'rb') as stdin:
+        subprocess.run(
+            [args.wl_copy, '--type', MIME_TYPE],
+            stdin=stdin, env=stats_environment(stats_write),
+            pass_fds=[stats_write], check=True
+        )
+    os.close(stats_write)
+    copy_stats = os.fdopen(stats_read)
+    # the first report is the one about setting the selection
+    copy_pid = json.loads(copy_stats.readline())['pid']
+    copy_cpu_before = cpu_seconds(copy_pid)
+
+    usage_before = resource.getrusage(resource.RUSAGE_CHILDREN)
+    start = time.monotonic()
+    pastes = []
+    for _ in range(readers):
+        paste_read, paste_write = os.pipe()
+        process = subprocess.Popen(
+            [args.wl_paste, '--no-newline', '--type', MIME_TYPE],
+            stdout=subprocess.DEVNULL, env=stats_environment(paste_write),
+            pass_fds=[paste_write]
+        )
+        os.close(paste_write)
+        pastes.append((process, os.fdopen(paste_read)))
+    paste_rates = []
+    for process, paste_stats in pastes:
+        report = paste_stats.read()
+        if process.wait() != 0:
+            sys.exit('wl-paste failed')
+        for line in report.splitlines():
+            paste_rates += transfer_rates(line)
+        paste_stats.close()
+    wall = time.monotonic() - start
+    usage_after = resource.getrusage(resource.RUSAGE_CHILDREN)
+
+    # wl-copy reports every finished transfer separately
+    copy_rates = []
+    while len(copy_rates) < readers:
+        line = copy_stats.readline()
+        if not line:
+            break
+        copy_rates += transfer_rates(line)
+    copy_cpu_after = cpu_seconds(copy_pid)
+    subprocess.run([args.wl_copy, '--clear'], check=True)
+    copy_stats.read()
+    copy_stats.close()
+
+    paste_cpu = (usage_after.ru_utime - usage_before.ru_utime +
+                 usage_after.ru_stime - usage_before.ru_stime)
+    result = {
+        'bytes': size,
+        'readers': readers,
+        'wall_s': round(wall, 6),
+        'aggregate_mb_per_s': round(size * readers / wall / 1e6, 3),
+        'copy_mb_per_s_p50': median(copy_rates),
+        'paste_mb_per_s_p50': median(paste_rates),
+        'paste_cpu_ms_per_transfer': round(paste_cpu * 1000 / readers, 3),
+    }
+    if copy_cpu_before is not None and copy_cpu_after is not None:
+        copy_cpu = copy_cpu_after - copy_cpu_before
+        result['copy_cpu_ms_per_transfer'] = round(
+            copy_cpu * 1000 / readers, 3
+        )
+    return result
+
+
+def median(values):
+    if not values:
+        return None
+    values = sorted(values)
+    return values[len(values) // 2]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('wl_copy')
+    parser.add_argument('wl_paste')
+    parser.add_argument(
+        '--sizes', default=os.environ.get('BENCH_SIZES', '1,1K,1M,64M'),
+        help='comma-separated payload sizes, such as 1,1M,4G'
+    )
+    parser.add_argument(
+        '--readers', default=os.environ.get('BENCH_READERS', '1,4,16,64'),
+        help='comma-separated numbers of concurrent wl-paste processes'
+    )
+    args = parser.parse_args()
+
+    if 'WAYLAND_DISPLAY' not in os.environ:
+        print('WAYLAND_DISPLAY is not set, skipping', file=sys.stderr)
+        sys.exit(77)
+
+    sizes = [parse_size(size) for size in args.sizes.split(',')]
+    readers = [int(count) for count in args.readers.split(',')]
+    with tempfile.TemporaryDirectory(prefix='wl-clipboard-bench-') as tmp:
+        for size in sizes:
+            payload = make_payload(tmp, size)
+            for count in readers:
+                print(json.dumps(run_case(args, payload, size, count)))
+                sys.stdout.flush()
+            os.unlink(payload)
+
+
+if __name__ == '__main__':
+    main()
@@ -18,6 +18,19 @@
 
 #include "boilerplate.h"
 
+static struct wl_registry *registry;
+
+static void *bind_global
+(
+    struct wl_registry *registry,
+    uint32_t name,
+    const struct wl_interface *interface,
+    uint32_t version
+) {
+    trace_probe(registry_bind, interface->name, version);
+    return wl_registry_bind(registry, name, interface, version);
+}
+
 void registry_global_handler
 (
     void *data,
@@ -27,14 +40,14 @@ void registry_global_handler
     uint32_t version
 ) {
     if (strcmp(interface, "wl_data_device_manager") == 0) {
-        data_device_manager = wl_registry_bind(
+        data_device_manager = bind_global(
             registry,
             name,
             &wl_data_device_manager_interface,
             1
         );
     } else if (strcmp(interface, "wl_seat") == 0) {
-        struct wl_seat *new_seat = wl_registry_bind(
+        struct wl_seat *new_seat = bind_global(
             registry,
             name,
             &wl_seat_interface,
@@ -42,21 +55,21 @@ void registry_global_handler
         );
         process_new_seat(new_seat);
     } else if (strcmp(interface, "wl_compositor") == 0) {
-        compositor = wl_registry_bind(
+        compositor = bind_global(
             registry,
             name,
             &wl_compositor_interface,
             3
         );
     } else if (strcmp(interface, "wl_shm") == 0) {
-        shm = wl_registry_bind(
+        shm = bind_global(
             registry,
             name,
             &wl_shm_interface,
             1
         );
     } else if (strcmp(interface, "wl_shell") == 0) {
-        shell = wl_registry_bind(
+        shell = bind_global(
             registry,
             name,
             &wl_shell_interface,
@@ -65,7 +78,7 @@ void registry_global_handler
     }
 #ifdef HAVE_XDG_SHELL
     else if (strcmp(interface, "xdg_wm_base") == 0) {
-        xdg_wm_base = wl_registry_bind(
+        xdg_wm_base = bind_global(
             registry,
             name,
             &xdg_wm_base_interface,
@@ -75,7 +88,7 @@ void registry_global_handler
 #endif
 #ifdef HAVE_WLR_LAYER_SHELL
     else if (strcmp(interface, "zwlr_layer_shell_v1") == 0) {
-        layer_shell = wl_registry_bind(
+        layer_shell = bind_global(
             registry,
             name,
             &zwlr_layer_shell_v1_interface,
@@ -85,7 +98,7 @@ void registry_global_handler
 #endif
 #ifdef HAVE_GTK_PRIMARY_SELECTION
     else if (strcmp(interface, "gtk_primary_selection_device_manager") == 0) {
-        gtk_primary_selection_device_manager = wl_registry_bind(
+        gtk_primary_selection_device_manager = bind_global(
             registry,
             name,
             &gtk_primary_selection_device_manager_interface,
@@ -95,7 +108,7 @@ void registry_global_handler
 #endif
 #ifdef HAVE_WP_PRIMARY_SELECTION
     else if (strcmp(interface, "zwp_primary_selection_device_manager_v1") == 0) {
-        primary_selection_device_manager = wl_registry_bind(
+        primary_selection_device_manager = bind_global(
             registry,
             name,
             &zwp_primary_selection_device_manager_v1_interface,
@@ -105,11 +118,18 @@ void registry_global_handler
 #endif
 #ifdef HAVE_WLR_DATA_CONTROL
     else if (strcmp(interface, "zwlr_data_control_manager_v1") == 0) {
-        data_control_manager = wl_registry_bind(
+        // lets the benchmarks and the curious exercise the other paths
+        if (getenv("WL_CLIPBOARD_NO_DATA_CONTROL") != NULL) {
+            return;
+        }
+        // version 2 also sends primary selection events,
+        // so only bind it for those who want to handle them
+        uint32_t wanted_version = want_wlr_data_control_primary ? 2 : 1;
+        data_control_manager = bind_global(
             registry,
             name,
             &zwlr_data_control_manager_v1_interface,
-            1
+            version < wanted_version ? version : wanted_version
         );
     }
 #endif
@@ -138,6 +158,9 @@ void keyboard_keymap_handler
     close(fd);
 }
 
+// the keyboard enter serial, once the popup surface has the focus
+static uint32_t popup_focus_serial;
+
 void keyboard_enter_handler
 (
     void *data,
@@ -151,6 +174,11 @@ void keyboard_enter_handler
     if (this_seat != seat) {
         return;
     }
+    stats_phase("focus");
+    trace_probe(focus_gained, serial);
+    if (surface != NULL) {
+        popup_focus_serial = serial;
+    }
     if (action_on_popup_surface_getting_focus != NULL) {
         action_on_popup_surface_getting_focus(serial);
     }
@@ -193,6 +221,10 @@ const struct wl_keyboard_listener keayboard_listener = {
     .modifiers = keyboard_modifiers_handler,
 };
 
+// the keyboards of all the seats, to get the focus with
+static struct wl_keyboard **keyboards;
+static size_t keyboard_count;
+
 void seat_capabilities_handler
 (
     void *data,
@@ -206,6 +238,11 @@ void seat_capabilities_handler
     if (capabilities & WL_SEAT_CAPABILITY_KEYBOARD) {
         struct wl_keyboard *keyboard = wl_seat_get_keyboard(this_seat);
         wl_keyboard_add_listener(keyboard, &keayboard_listener, this_seat);
+        keyboards = realloc(
+            keyboards,
+            (keyboard_count + 1) * sizeof(struct wl_keyboard *)
+        );
+        keyboards[keyboard_count++] = keyboard;
     }
 }
 
@@ -372,12 +409,14 @@ void init_wayland_globals() {
     if (display == NULL) {
         bail("Failed to connect to a Wayland server");
     }
+    stats_phase("connect");
 
-    struct wl_registry *registry = wl_display_get_registry(display);
+    registry = wl_display_get_registry(display);
     wl_registry_add_listener(registry, &registry_listener, NULL);
 
     // wait for the "initial" set of globals to appear
     wl_display_roundtrip(display);
+    stats_phase("registry");
 
     if (
         data_device_manager == NULL ||
@@ -404,6 +443,8 @@ void init_wayland_globals() {
         }
         bail("Cannot find the requested seat");
     }
+    stats_phase("seat");
+    trace_probe(seat_resolved, seat, requested_seat_name);
 
     data_device = wl_data_device_manager_get_data_device(
         data_device_manager,
@@ -475,11 +516,90 @@ int create_anonymous_file() {
     return fileno(tmpfile());
 }
 
+int create_disk_backed_file() {
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    char path[PATH_MAX];
+    if (cache_home != NULL && cache_home[0] != '\0') {
+        snprintf(path, sizeof(path), "%s", cache_home);
+    } else if (getenv("HOME") != NULL) {
+        snprintf(path, sizeof(path), "%s/.cache", getenv("HOME"));
+    } else {
+        return -1;
+    }
+    if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+        return -1;
+    }
+#ifdef HAVE_TMPFS_MAGIC
+    struct statfs st;
+    if (
+        statfs(path, &st) < 0 ||
+        st.f_type == TMPFS_MAGIC ||
+        st.f_type == RAMFS_MAGIC
+    ) {
+        return -1;
+    }
+#endif
+    int fd;
+#ifdef O_TMPFILE
+    // never linked into the directory, so nothing is left behind
+    fd = open(path, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+        return fd;
+    }
+#endif
+    strncat(path, "/wl-copy-XXXXXX", sizeof(path) - strlen(path) - 1);
+    fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    return fd;
+}
+
+int open_file_snapshot(const char *path, int *is_snapshot) {
+    *is_snapshot = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+#if defined(HAVE_FICLONE) && defined(O_TMPFILE)
+    // a clone has to live on the same filesystem
+    char *dir_path = strdup(path);
+    int clone_fd = open(dirname(dir_path), O_TMPFILE | O_RDWR, 0600);
+    free(dir_path);
+    if (clone_fd < 0) {
+        return fd;
+    }
+    if (ioctl(clone_fd, FICLONE, fd) < 0) {
+        // most likely EOPNOTSUPP or EXDEV
+        close(clone_fd);
+        return fd;
+    }
+    close(fd);
+    *is_snapshot = 1;
+    return clone_fd;
+#else
+    return fd;
+#endif
+}
+
+static struct wl_buffer *popup_buffer;
+
 void popup_tiny_invisible_surface() {
     // HACK:
     // pop up a tiny invisible surface to get the keyboard focus,
     // otherwise we won't be notified of the selection
 
+    // if it's still up from earlier, reuse it
+    if (surface != NULL) {
+        if (
+            popup_focus_serial != 0 &&
+            action_on_popup_surface_getting_focus != NULL
+        ) {
+            action_on_popup_surface_getting_focus(popup_focus_serial);
+        }
+        return;
+    }
+
     if (!ensure_seat_has_keyboard()) {
         return;
     }
@@ -557,11 +677,15 @@ void popup_tiny_invisible_surface() {
     struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
 
     // allocate the buffer in that pool
-    struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool,
+    popup_buffer = wl_shm_pool_create_buffer(pool,
         0, width, height, stride, WL_SHM_FORMAT_ARGB8888);
     // zeros in ARGB8888 mean fully transparent
 
-    wl_surface_attach(surface, buffer, 0, 0);
+    // the buffer keeps the memory alive by itself
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    wl_surface_attach(surface, popup_buffer, 0, 0);
     wl_surface_damage(surface, 0, 0, width, height);
     wl_surface_commit(surface);
 }
@@ -591,6 +715,46 @@ void destroy_popup_surface() {
         wl_surface_destroy(surface);
         surface = NULL;
     }
+    if (popup_buffer != NULL) {
+        wl_buffer_destroy(popup_buffer);
+        popup_buffer = NULL;
+    }
+    popup_focus_serial = 0;
+}
+
+void release_focus_objects() {
+    destroy_popup_surface();
+    for (size_t i = 0; i < keyboard_count; i++) {
+        wl_keyboard_destroy(keyboards[i]);
+    }
+    free(keyboards);
+    keyboards = NULL;
+    keyboard_count = 0;
+    action_on_popup_surface_getting_focus = NULL;
+
+#ifdef HAVE_XDG_SHELL
+    if (xdg_wm_base != NULL) {
+        xdg_wm_base_destroy(xdg_wm_base);
+        xdg_wm_base = NULL;
+    }
+#endif
+#ifdef HAVE_WLR_LAYER_SHELL
+    if (layer_shell != NULL) {
+        // the destroy request only exists since version 3
+        wl_proxy_destroy((struct wl_proxy *) layer_shell);
+        layer_shell = NULL;
+    }
+#endif
+    if (shell != NULL) {
+        wl_shell_destroy(shell);
+        shell = NULL;
+    }
+    wl_shm_destroy(shm);
+    shm = NULL;
+    wl_compositor_destroy(compositor);
+    compositor = NULL;
+    wl_registry_destroy(registry);
+    registry = NULL;
 }
 
 static uint32_t global_serial;
@@ -615,10 +779,259 @@ uint32_t get_serial() {
     while (global_serial == 0) {
         wl_display_dispatch(display);
     }
+    stats_phase("serial");
 
     return global_serial;
 }
 
+static void process_offered_type(const char *mime_type) {
+    trace_probe(offer_type, mime_type);
+    if (action_on_offered_type != NULL) {
+        action_on_offered_type(mime_type);
+    }
+}
+
+static void process_selection
+(
+    void *offer,
+    void (*receive_f)(void *offer, const char *mime_type, int fd)
+) {
+    trace_probe(offer_received, offer);
+    if (action_on_selection != NULL) {
+        action_on_selection(offer, receive_f);
+    }
+}
+
+void data_offer_offer
+(
+    void *data,
+    struct wl_data_offer *data_offer,
+    const char *offered_mime_type
+) {
+    process_offered_type(offered_mime_type);
+}
+
+const struct wl_data_offer_listener data_offer_listener = {
+    .offer = data_offer_offer
+};
+
+void data_device_data_offer
+(
+    void *data,
+    struct wl_data_device *data_device,
+    struct wl_data_offer *data_offer
+) {
+    wl_data_offer_add_listener(data_offer, &data_offer_listener, NULL);
+}
+
+void data_device_selection
+(
+    void *data,
+    struct wl_data_device *data_device,
+    struct wl_data_offer *data_offer
+) {
+    process_selection(
+        data_offer,
+        (void (*)(void *, const char *, int)) wl_data_offer_receive
+    );
+}
+
+const struct wl_data_device_listener data_device_listener = {
+    .data_offer = data_device_data_offer,
+    .selection = data_device_selection
+};
+
+#ifdef HAVE_GTK_PRIMARY_SELECTION
+
+void gtk_primary_selection_offer_offer
+(
+    void *data,
+    struct gtk_primary_selection_offer *gtk_primary_selection_offer,
+    const char *offered_mime_type
+) {
+    process_offered_type(offered_mime_type);
+}
+
+const struct gtk_primary_selection_offer_listener
+gtk_primary_selection_offer_listener = {
+    .offer = gtk_primary_selection_offer_offer
+};
+
+void gtk_primary_selection_device_data_offer
+(
+    void *data,
+    struct gtk_primary_selection_device *gtk_primary_selection_device,
+    struct gtk_primary_selection_offer *gtk_primary_selection_offer
+) {
+    gtk_primary_selection_offer_add_listener(
+        gtk_primary_selection_offer,
+        &gtk_primary_selection_offer_listener,
+        NULL
+    );
+}
+
+void gtk_primary_selection_device_selection
+(
+    void *data,
+    struct gtk_primary_selection_device *gtk_primary_selection_device,
+    struct gtk_primary_selection_offer *gtk_primary_selection_offer
+) {
+    process_selection(
+        gtk_primary_selection_offer,
+        (void (*)(void *, const char *, int))
+              gtk_primary_selection_offer_receive
+    );
+}
+
+const struct gtk_primary_selection_device_listener
+gtk_primary_selection_device_listener = {
+    .data_offer = gtk_primary_selection_device_data_offer,
+    .selection = gtk_primary_selection_device_selection
+};
+
+#endif
+
+#ifdef HAVE_WP_PRIMARY_SELECTION
+
+void primary_selection_offer_offer
+(
+    void *data,
+    struct zwp_primary_selection_offer_v1 *primary_selection_offer,
+    const char *offered_mime_type
+) {
+    process_offered_type(offered_mime_type);
+}
+
+const struct zwp_primary_selection_offer_v1_listener
+primary_selection_offer_listener = {
+    .offer = primary_selection_offer_offer
+};
+
+void primary_selection_device_data_offer
+(
+    void *data,
+    struct zwp_primary_selection_device_v1 *primary_selection_device,
+    struct zwp_primary_selection_offer_v1 *primary_selection_offer
+) {
+    zwp_primary_selection_offer_v1_add_listener(
+        primary_selection_offer,
+        &primary_selection_offer_listener,
+        NULL
+    );
+}
+
+void primary_selection_device_selection
+(
+    void *data,
+    struct zwp_primary_selection_device_v1 *primary_selection_device,
+    struct zwp_primary_selection_offer_v1 *primary_selection_offer
+) {
+    process_selection(
+        primary_selection_offer,
+        (void (*)(void *, const char *, int))
+              zwp_primary_selection_offer_v1_receive
+    );
+}
+
+const struct zwp_primary_selection_device_v1_listener
+primary_selection_device_listener = {
+    .data_offer = primary_selection_device_data_offer,
+    .selection = primary_selection_device_selection
+};
+
+#endif
+
+#ifdef HAVE_WLR_DATA_CONTROL
+void data_control_offer_offer
+(
+    void *data,
+    struct zwlr_data_control_offer_v1 *data_offer,
+    const char *offered_mime_type
+) {
+    process_offered_type(offered_mime_type);
+}
+
+const struct zwlr_data_control_offer_v1_listener data_control_offer_listener = {
+    .offer = data_control_offer_offer
+};
+
+void data_control_device_data_offer
+(
+    void *data,
+    struct zwlr_data_control_device_v1 *data_control_device,
+    struct zwlr_data_control_offer_v1 *data_control_offer
+) {
+    zwlr_data_control_offer_v1_add_listener(
+        data_control_offer,
+        &data_control_offer_listener,
+        NULL
+    );
+}
+
+void data_control_device_selection
+(
+    void *data,
+    struct zwlr_data_control_device_v1 *data_control_device,
+    struct zwlr_data_control_offer_v1 *data_control_offer
+) {
+    process_selection(
+        data_control_offer,
+        (void (*)(void *, const char *, int)) zwlr_data_control_offer_v1_receive
+    );
+}
+
+const struct zwlr_data_control_device_v1_listener
+data_control_device_listener = {
+    .data_offer = data_control_device_data_offer,
+    .selection = data_control_device_selection
+};
+#endif
+
+void watch_selection(int primary) {
+    if (!primary) {
+        if (use_wlr_data_control) {
+#ifdef HAVE_WLR_DATA_CONTROL
+            zwlr_data_control_device_v1_add_listener(
+                data_control_device,
+                &data_control_device_listener,
+                NULL
+            );
+#endif
+        } else {
+            wl_data_device_add_listener(
+                data_device,
+                &data_device_listener,
+                NULL
+            );
+        }
+        return;
+    }
+
+    ensure_has_primary_selection();
+
+#ifdef HAVE_WP_PRIMARY_SELECTION
+    if (primary_selection_device != NULL) {
+        zwp_primary_selection_device_v1_add_listener(
+            primary_selection_device,
+            &primary_selection_device_listener,
+            NULL
+        );
+        return;
+    }
+#endif
+
+#ifdef HAVE_GTK_PRIMARY_SELECTION
+    if (gtk_primary_selection_device != NULL) {
+        gtk_primary_selection_device_add_listener(
+            gtk_primary_selection_device,
+            &gtk_primary_selection_device_listener,
+            NULL
+        );
+        return;
+    }
+#endif
+}
+
 int mime_type_is_text(const char *mime_type) {
     return str_has_prefix(mime_type, "text/")
         || strcmp(mime_type, "TEXT") == 0
@@ -644,6 +1057,33 @@ int str_has_suffix(const char *string, const char *suffix) {
     return strcmp(string + offset, suffix) == 0;
 }
 
+int parse_size(const char *string, off_t *size) {
+    char *end;
+    errno = 0;
+    long long value = strtoll(string, &end, 10);
+    if (errno != 0 || end == string || value < 0) {
+        return 0;
+    }
+    int shift = 0;
+    switch (*end) {
+    case 'G':
+        shift += 10;
+        // fallthrough
+    case 'M':
+        shift += 10;
+        // fallthrough
+    case 'K':
+        shift += 10;
+        end++;
+        break;
+    }
+    if (*end != 0 || value > (LLONG_MAX >> shift)) {
+        return 0;
+    }
+    *size = (off_t) (value << shift);
+    return 1;
+}
+
 void print_version_info() {
     printf(
         "wl-clipboard " PROJECT_VERSION "\n"
@@ -708,20 +1148,7 @@ const char *get_file_extension(const char *file_path) {
     return ext + 1;
 }
 
-char *infer_mime_type_from_name(const char *file_path) {
-    const char *actual_ext = get_file_extension(file_path);
-    if (actual_ext == NULL) {
-        return NULL;
-    }
-
-    FILE *f = fopen("/etc/mime.types", "r");
-    if (f == NULL) {
-        f = fopen("/usr/local/etc/mime.types", "r");
-    }
-    if (f == NULL) {
-        return NULL;
-    }
-
+char *find_mime_type_for_extension(FILE *f, const char *extension) {
     for (char line[200]; fgets(line, sizeof(line), f) != NULL;) {
         // skip comments and blank lines
         if (line[0] == '#' || line[0] == '\n') {
@@ -737,18 +1164,40 @@ char *infer_mime_type_from_name(const char *file_path) {
         }
         char *lineptr = line + consumed;
         for (char ext[200]; sscanf(lineptr, "%s%n", ext, &consumed) == 1;) {
-            if (strcmp(ext, actual_ext) == 0) {
-                fclose(f);
+            if (strcmp(ext, extension) == 0) {
                 return strdup(mime_type);
             }
             lineptr += consumed;
         }
     }
-    fclose(f);
     return NULL;
 }
 
-char *dump_stdin_into_a_temp_file() {
+char *infer_mime_type_from_name(const char *file_path) {
+    const char *actual_ext = get_file_extension(file_path);
+    if (actual_ext == NULL) {
+        return NULL;
+    }
+
+    FILE *f = fopen("/etc/mime.types", "r");
+    if (f == NULL) {
+        f = fopen("/usr/local/etc/mime.types", "r");
+    }
+    if (f == NULL) {
+        return NULL;
+    }
+    char *mime_type = find_mime_type_for_extension(f, actual_ext);
+    fclose(f);
+    return mime_type;
+}
+
+static int write_all(int fd, const char *data, size_t size);
+
+static int write_to_fd(void *data, const char *buffer, size_t size) {
+    return write_all(*(int *) data, buffer, size);
+}
+
+char *dump_stdin_into_a_temp_file(const struct normalize_options *normalize) {
     char dirpath[] = "/tmp/wl-copy-buffer-XXXXXX";
     if (mkdtemp(dirpath) != dirpath) {
         perror("mkdtemp");
@@ -767,58 +1216,240 @@ char *dump_stdin_into_a_temp_file() {
         strcat(res_path, "stdin");
     }
 
-    if (fork() == 0) {
-        int fd = creat(res_path, S_IRUSR | S_IWUSR);
-        if (fd < 0) {
-            perror("creat");
-            exit(1);
-        }
-        dup2(fd, STDOUT_FILENO);
-        close(fd);
-        execlp("cat", "cat", NULL);
-        perror("exec cat");
+    int fd = creat(res_path, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        perror("creat");
         exit(1);
     }
-
-    int wstatus;
-    wait(&wstatus);
+    int failed;
+    if (normalize_options_active(normalize)) {
+        struct normalizer *normalizer = normalizer_create(
+            normalize,
+            write_to_fd,
+            &fd
+        );
+        failed = normalize_fd(STDIN_FILENO, normalizer) < 0;
+        failed |= !normalizer_finish(normalizer);
+    } else {
+        // splice() moves the data from a pipe without copying it
+        // through our buffers, and there's no cat to spawn
+        copy_fd_range(STDIN_FILENO, fd, 0, -1);
+        failed = errno != 0;
+    }
+    failed |= close(fd) < 0;
     if (original_path != NULL) {
         free(original_path);
     }
-    if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0) {
+    if (!failed) {
         return res_path;
     }
     bail("Failed to copy the file");
 }
 
-void trim_trailing_newline(const char *file_path) {
-    int fd = open(file_path, O_RDWR);
+void normalize_file
+(
+    const char *path,
+    const struct normalize_options *normalize
+) {
+    int in_fd = open(path, O_RDONLY);
+    if (in_fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    // write next to the file, and replace it once done
+    char *normalized_path = malloc(strlen(path) + sizeof(".normalized"));
+    strcpy(normalized_path, path);
+    strcat(normalized_path, ".normalized");
+    int fd = creat(normalized_path, S_IRUSR | S_IWUSR);
     if (fd < 0) {
-        perror("open file for trimming");
-        return;
+        perror("creat");
+        exit(1);
+    }
+
+    struct normalizer *normalizer = normalizer_create(
+        normalize,
+        write_to_fd,
+        &fd
+    );
+    int failed = normalize_fd(in_fd, normalizer) < 0;
+    failed |= !normalizer_finish(normalizer);
+    failed |= close(fd) < 0;
+    close(in_fd);
+    if (!failed) {
+        failed = rename(normalized_path, path) < 0;
+    }
+    if (failed) {
+        unlink(normalized_path);
+        bail("Failed to normalize the text");
     }
+    free(normalized_path);
+}
 
-    int seek_res = lseek(fd, -1, SEEK_END);
-    if (seek_res < 0 && errno == EINVAL) {
-        // empty file
-        goto out;
-    } else if (seek_res < 0) {
-        perror("lseek");
-        goto out;
+// how much to transfer at once without going past the limit
+static size_t chunk_size(off_t limit, off_t done, size_t chunk) {
+    if (limit >= 0 && limit - done < (off_t) chunk) {
+        return limit - done;
     }
-    // otherwise, seek_res is the new file size
+    return chunk;
+}
 
-    char last_char;
-    int read_res = read(fd, &last_char, 1);
-    if (read_res != 1) {
-        perror("read");
-        goto out;
+off_t discard_fd_data(int fd, off_t count) {
+    off_t discarded = 0;
+#ifdef HAVE_SPLICE
+    // let the kernel throw the data away without
+    // copying it into our address space
+    int devnull = open("/dev/null", O_WRONLY);
+    while (devnull >= 0 && discarded < count) {
+        ssize_t res = splice(
+            fd, NULL, devnull, NULL,
+            count - discarded, SPLICE_F_MOVE
+        );
+        if (res <= 0) {
+            break;
+        }
+        discarded += res;
     }
-    if (last_char != '\n') {
-        goto out;
+    if (devnull >= 0) {
+        close(devnull);
     }
+#endif
+    char buffer[64 * 1024];
+    while (discarded < count) {
+        ssize_t res = read(
+            fd, buffer, chunk_size(count, discarded, sizeof(buffer))
+        );
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            break;
+        }
+        discarded += res;
+    }
+    return discarded;
+}
 
-    ftruncate(fd, seek_res);
-out:
-    close(fd);
+static int write_all(int fd, const char *data, size_t size) {
+    for (size_t written = 0; written < size;) {
+        ssize_t res = write(fd, data + written, size - written);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res < 0) {
+            // the other side going away early is not an error
+            if (errno != EPIPE) {
+                perror("write");
+            }
+            return 0;
+        }
+        written += res;
+    }
+    return 1;
+}
+
+off_t hash_fd_data(int fd, struct hash_state *state, int copy_fd, off_t limit) {
+    char buffer[64 * 1024];
+    off_t total = 0;
+    while (limit < 0 || total < limit) {
+        ssize_t res = read(fd, buffer, chunk_size(limit, total, sizeof(buffer)));
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res < 0) {
+            perror("read");
+        }
+        if (res <= 0) {
+            break;
+        }
+        hash_update(state, buffer, res);
+        if (copy_fd >= 0 && !write_all(copy_fd, buffer, res)) {
+            break;
+        }
+        total += res;
+    }
+    return total;
+}
+
+off_t copy_fd_range(int from_fd, int to_fd, off_t skip, off_t limit) {
+    errno = 0;
+    if (skip > 0 && discard_fd_data(from_fd, skip) < skip) {
+        // the data ended before the range started
+        return 0;
+    }
+
+    off_t copied = 0;
+
+#ifdef HAVE_SPLICE
+    // this fails if neither end is a pipe, or if
+    // the output doesn't support splicing into it
+    while (limit < 0 || copied < limit) {
+        ssize_t res = splice(
+            from_fd, NULL, to_fd, NULL,
+            chunk_size(limit, copied, 64 * 1024), SPLICE_F_MOVE
+        );
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res == 0 || (res < 0 && errno == EPIPE)) {
+            errno = 0;
+            return copied;
+        }
+        if (res < 0) {
+            break;
+        }
+        copied += res;
+    }
+#endif
+
+    char buffer[64 * 1024];
+    int error = 0;
+    while (limit < 0 || copied < limit) {
+        ssize_t res = read(from_fd, buffer, chunk_size(limit, copied, sizeof(buffer)));
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res < 0) {
+            error = errno;
+            perror("read");
+        }
+        if (res <= 0) {
+            break;
+        }
+        if (!write_all(to_fd, buffer, res)) {
+            error = errno == EPIPE ? 0 : errno;
+            break;
+        }
+        copied += res;
+    }
+    errno = error;
+    return copied;
+}
+
+ssize_t send_file_chunk(int file_fd, off_t *offset, int to_fd) {
+#ifdef HAVE_SPLICE
+    static int splice_unsupported = 0;
+    if (!splice_unsupported) {
+        ssize_t res = splice(
+            file_fd, offset, to_fd, NULL,
+            64 * 1024, SPLICE_F_MOVE | SPLICE_F_NONBLOCK
+        );
+        if (res >= 0 || (errno != EINVAL && errno != ENOSYS)) {
+            return res;
+        }
+        // the output doesn't support splicing into it,
+        // so copy through our own buffer from now on
+        splice_unsupported = 1;
+    }
+#endif
+
+    char buffer[64 * 1024];
+    ssize_t res = pread(file_fd, buffer, sizeof(buffer), *offset);
+    if (res <= 0) {
+        return res;
+    }
+    res = write(to_fd, buffer, res);
+    if (res > 0) {
+        *offset += res;
+    }
+    return res;
 }
@@ -16,7 +16,22 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE // splice
+
 #include "config.h"
+#include "hash.h"
+#include "stats.h"
+#include "metrics.h"
+#include "trace.h"
+#include "loop.h"
+#include "uring.h"
+#include "text.h"
+#include "normalize.h"
+#include "convert.h"
+#include "mirror.h"
+#include "meta.h"
+#include "cache.h"
+#include "workers.h"
 
 #include <wayland-client.h>
 #include <stdio.h>
@@ -31,13 +46,23 @@
 #include <stdlib.h> // exit
 #include <libgen.h> // basename
 #include <sys/wait.h>
+#include <poll.h>
 #include <limits.h> // PATH_MAX
+#include <signal.h>
+#include <sys/mman.h> // mmap
 
 #ifdef HAVE_MEMFD
 #    include <sys/syscall.h> // syscall, SYS_memfd_create
 #endif
-#ifdef HAVE_SHM_ANON
-#    include <sys/mman.h> // shm_open, SHM_ANON
+
+#ifdef HAVE_FICLONE
+#    include <sys/ioctl.h>
+#    include <linux/fs.h> // FICLONE
+#endif
+
+#ifdef HAVE_TMPFS_MAGIC
+#    include <sys/vfs.h> // statfs
+#    include <linux/magic.h> // TMPFS_MAGIC
 #endif
 
 
@@ -108,9 +133,17 @@ const char *requested_seat_name;
 
 void init_wayland_globals(void);
 int use_wlr_data_control;
+// set this before init_wayland_globals() to also get
+// the primary selection through wlr-data-control
+int want_wlr_data_control_primary;
 
+// if the surface is already up, this reuses it, calling
+// action_on_popup_surface_getting_focus right away if it has the focus
 void popup_tiny_invisible_surface(void);
 void destroy_popup_surface(void);
+// lets go of the popup surface, the keyboards and the globals only
+// needed to create it, and of the registry; nothing may use them after
+void release_focus_objects(void);
 
 void (*action_on_popup_surface_getting_focus)(uint32_t serial);
 void (*action_on_no_keyboard)(void);
@@ -119,13 +152,59 @@ void ensure_has_primary_selection(void);
 
 uint32_t get_serial(void);
 
+// start listening for the selection (or the primary selection) being set;
+// the compositor sends the current one right away, or, unless using
+// wlr-data-control, once we get the keyboard focus
+void watch_selection(int primary);
+
+void (*action_on_offered_type)(const char *mime_type);
+void (*action_on_selection)(
+    void *offer,
+    void (*receive_f)(void *offer, const char *mime_type, int fd)
+);
+
 int mime_type_is_text(const char *mime_type);
 int str_has_prefix(const char *string, const char *prefix);
 int str_has_suffix(const char *string, const char *suffix);
+// returns the part of the file name after the last dot, if any
+const char *get_file_extension(const char *file_path);
+
+// parses a byte count such as 4096, 64K or 2M;
+// returns 0 if the string is not a valid size
+int parse_size(const char *string, off_t *size);
 
 void print_version_info(void);
 
-void trim_trailing_newline(const char *file_path);
+// reads and throws away count bytes; returns how many bytes
+// were actually discarded, which is less on end of file
+off_t discard_fd_data(int fd, off_t count);
+
+// reads at most limit bytes (or everything if limit is negative) from fd,
+// feeding them into the hash; if copy_fd is not -1, also writes them there;
+// returns the number of bytes read
+off_t hash_fd_data(int fd, struct hash_state *state, int copy_fd, off_t limit);
+
+// copies data from one file descriptor to another, first discarding
+// skip bytes, then copying at most limit bytes (or everything that's
+// left if limit is negative); returns the number of bytes copied,
+// leaving errno set if reading or writing failed and zero otherwise
+off_t copy_fd_range(int from_fd, int to_fd, off_t skip, off_t limit);
+
+// copies a chunk of a regular file, starting at the given offset, to
+// a non-blocking file descriptor, and advances the offset; returns the
+// number of bytes copied, 0 at the end of the file, or -1 with errno
+// set to EAGAIN if the file descriptor can't take any more data now
+ssize_t send_file_chunk(int file_fd, off_t *offset, int to_fd);
+
+int create_anonymous_file(void);
+// a file in the cache directory, which unlike an anonymous file doesn't
+// take up memory; returns -1 if the directory is in memory after all
+int create_disk_backed_file(void);
+
+// opens a file for reading; where the filesystem supports reflinks,
+// returns an unnamed clone of it instead, which shares the file's
+// storage but never changes, and sets *is_snapshot
+int open_file_snapshot(const char *path, int *is_snapshot);
 
 // functions below this line return owned strings,
 // free() their return values when done with them
@@ -133,6 +212,14 @@ void trim_trailing_newline(const char *file_path);
 char *path_for_fd(int fd);
 char *infer_mime_type_from_contents(const char *file_path);
 char *infer_mime_type_from_name(const char *file_path);
-
-// returns the name of a new file
-char *dump_stdin_into_a_temp_file(void);
+// looks the extension up in a table in the mime.types format
+char *find_mime_type_for_extension(FILE *f, const char *extension);
+
+// returns the name of a new file; the data is passed
+// through text normalization if any is requested
+char *dump_stdin_into_a_temp_file(const struct normalize_options *normalize);
+// replaces the file with its text-normalized version
+void normalize_file(
+    const char *path,
+    const struct normalize_options *normalize
+);
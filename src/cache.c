@@ -0,0 +1,193 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cache.h"
+#include "hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h> // PATH_MAX
+#include <sys/stat.h>
+
+// opens the cache directory, creating it if needed
+static int open_cache_dir() {
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir == NULL || runtime_dir[0] == '\0') {
+        fprintf(stderr, "XDG_RUNTIME_DIR is not set, not caching\n");
+        return -1;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/wl-clipboard", runtime_dir);
+    // the content is only for our own eyes
+    if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+        perror("mkdir");
+        return -1;
+    }
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        perror("open cache directory");
+    }
+    return dir_fd;
+}
+
+// the suffix shared by all the entries of a clipboard and type
+static void format_type_suffix(
+    const char *mime_type,
+    char *buffer,
+    size_t size
+) {
+    snprintf(buffer, size, "-%s", mime_type);
+    for (char *ptr = buffer; *ptr != '\0'; ptr++) {
+        if (*ptr == '/') {
+            *ptr = '_';
+        }
+    }
+}
+
+static int format_entry_name(
+    const char *clipboard,
+    const char *mime_type,
+    uint64_t hash,
+    char *buffer,
+    size_t size
+) {
+    char fingerprint[FINGERPRINT_LENGTH + 1];
+    format_fingerprint(hash, fingerprint);
+    char suffix[NAME_MAX + 1];
+    format_type_suffix(mime_type, suffix, sizeof(suffix));
+    int length = snprintf(
+        buffer, size, "%s-%s%s",
+        clipboard, fingerprint, suffix
+    );
+    return length > 0 && length <= NAME_MAX && (size_t) length < size;
+}
+
+int cache_lookup(const char *clipboard, const char *mime_type, uint64_t hash) {
+    char name[NAME_MAX + 1];
+    if (!format_entry_name(clipboard, mime_type, hash, name, sizeof(name))) {
+        return -1;
+    }
+    int dir_fd = open_cache_dir();
+    if (dir_fd < 0) {
+        return -1;
+    }
+    int fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    close(dir_fd);
+    return fd;
+}
+
+int cache_begin(struct cache_store *store) {
+    store->dir_fd = open_cache_dir();
+    if (store->dir_fd < 0) {
+        return 0;
+    }
+    // entry names never start with a dot
+    for (int attempt = 0; attempt < 100; attempt++) {
+        snprintf(
+            store->temp_name, sizeof(store->temp_name),
+            ".tmp-%d-%d", (int) getpid(), attempt
+        );
+        store->fd = openat(
+            store->dir_fd, store->temp_name,
+            O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+            0600
+        );
+        if (store->fd >= 0 || errno != EEXIST) {
+            break;
+        }
+    }
+    if (store->fd < 0) {
+        perror("open cache file");
+        close(store->dir_fd);
+        return 0;
+    }
+    return 1;
+}
+
+// removes the other entries of the same clipboard and type
+static void evict(
+    int dir_fd,
+    const char *clipboard,
+    const char *mime_type,
+    const char *keep
+) {
+    char suffix[NAME_MAX + 1];
+    format_type_suffix(mime_type, suffix, sizeof(suffix));
+    size_t clipboard_length = strlen(clipboard);
+    size_t suffix_length = strlen(suffix);
+
+    int fd = dup(dir_fd);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (dir == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (
+            strlen(name) != clipboard_length + 1 +
+                FINGERPRINT_LENGTH + suffix_length ||
+            strncmp(name, clipboard, clipboard_length) != 0 ||
+            name[clipboard_length] != '-' ||
+            strcmp(
+                name + clipboard_length + 1 + FINGERPRINT_LENGTH,
+                suffix
+            ) != 0 ||
+            strcmp(name, keep) == 0
+        ) {
+            continue;
+        }
+        unlinkat(dir_fd, name, 0);
+    }
+    closedir(dir);
+}
+
+void cache_commit(
+    struct cache_store *store,
+    const char *clipboard,
+    const char *mime_type,
+    uint64_t hash
+) {
+    char name[NAME_MAX + 1];
+    if (!format_entry_name(clipboard, mime_type, hash, name, sizeof(name))) {
+        cache_abort(store);
+        return;
+    }
+    // readers either see the whole entry or none of it
+    if (renameat(store->dir_fd, store->temp_name, store->dir_fd, name) < 0) {
+        perror("rename cache file");
+        cache_abort(store);
+        return;
+    }
+    evict(store->dir_fd, clipboard, mime_type, name);
+    close(store->dir_fd);
+    store->dir_fd = -1;
+}
+
+void cache_abort(struct cache_store *store) {
+    unlinkat(store->dir_fd, store->temp_name, 0);
+    close(store->dir_fd);
+    store->dir_fd = -1;
+}
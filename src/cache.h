@@ -0,0 +1,60 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WL_CLIPBOARD_CACHE_H
+#define WL_CLIPBOARD_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// a cache of pasted content in $XDG_RUNTIME_DIR, so that pasting the
+// same selection again doesn't take another transfer from its owner;
+// entries are named after the clipboard, the type and the fingerprint
+// of the content, as advertised with wl-copy --offer-meta (see meta.h),
+// so a new selection never gets served stale content: it misses, and
+// storing its content evicts what was cached for the old one
+
+// content larger than this is not worth keeping in memory
+#define CACHE_MAX_ENTRY_SIZE (64 * 1024 * 1024)
+
+// returns a descriptor for the cached content, or -1 on a miss
+int cache_lookup(const char *clipboard, const char *mime_type, uint64_t hash);
+
+struct cache_store {
+    int dir_fd;
+    char temp_name[32];
+    // where to write the content; it stays open after the entry
+    // is committed or aborted, so that it can be read back
+    int fd;
+};
+
+// starts storing a new entry, returns 0 if the cache is unusable
+int cache_begin(struct cache_store *store);
+
+// makes the stored content available under the given name,
+// evicting the content previously cached for the same type
+void cache_commit(
+    struct cache_store *store,
+    const char *clipboard,
+    const char *mime_type,
+    uint64_t hash
+);
+
+// throws the stored content away
+void cache_abort(struct cache_store *store);
+
+#endif
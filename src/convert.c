@@ -0,0 +1,149 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boilerplate.h"
+
+static struct converter *new_converter
+(
+    const char *source_type,
+    const char *target_type,
+    enum converter_kind kind,
+    const char *command
+) {
+    struct converter *converter = calloc(1, sizeof(struct converter));
+    converter->source_type = strdup(source_type);
+    converter->target_type = strdup(target_type);
+    converter->kind = kind;
+    if (command != NULL) {
+        converter->command = strdup(command);
+    }
+    return converter;
+}
+
+static char *config_file_path() {
+    const char *config_home = getenv("XDG_CONFIG_HOME");
+    const char *suffix = "/wl-clipboard/converters";
+    char *path = malloc(PATH_MAX);
+    if (config_home != NULL && config_home[0] != '\0') {
+        snprintf(path, PATH_MAX, "%s%s", config_home, suffix);
+    } else if (getenv("HOME") != NULL) {
+        snprintf(path, PATH_MAX, "%s/.config%s", getenv("HOME"), suffix);
+    } else {
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
+// splits off the next whitespace-separated word, or returns NULL
+static char *next_word(char **line) {
+    char *start = *line + strspn(*line, " \t");
+    if (*start == '\0') {
+        return NULL;
+    }
+    char *end = start + strcspn(start, " \t");
+    if (*end != '\0') {
+        *end++ = '\0';
+    }
+    *line = end;
+    return start;
+}
+
+static struct converter *parse_line(char *line) {
+    char *source_type = next_word(&line);
+    char *target_type = next_word(&line);
+    char *command = line + strspn(line, " \t");
+    if (source_type == NULL || target_type == NULL || *command == '\0') {
+        return NULL;
+    }
+    if (command[0] != '@') {
+        return new_converter(
+            source_type,
+            target_type,
+            CONVERTER_COMMAND,
+            command
+        );
+    }
+    if (strcmp(command, "@latin1") == 0) {
+        return new_converter(source_type, target_type, CONVERTER_LATIN1, NULL);
+    }
+    return NULL;
+}
+
+struct converter *load_converters() {
+    // X11 clients expect STRING to be in Latin-1
+    struct converter *head = new_converter(
+        "text",
+        "STRING",
+        CONVERTER_LATIN1,
+        NULL
+    );
+    struct converter *tail = head;
+
+    char *path = config_file_path();
+    FILE *f = path != NULL ? fopen(path, "r") : NULL;
+    if (f == NULL) {
+        free(path);
+        return head;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    for (int line_number = 1; (length = getline(&line, &capacity, f)) >= 0;) {
+        if (length > 0 && line[length - 1] == '\n') {
+            line[length - 1] = '\0';
+        }
+        const char *content = line + strspn(line, " \t");
+        if (*content != '\0' && *content != '#') {
+            struct converter *converter = parse_line(line);
+            if (converter == NULL) {
+                fprintf(
+                    stderr,
+                    "%s:%d: invalid converter, ignoring\n",
+                    path,
+                    line_number
+                );
+            } else {
+                tail->next = converter;
+                tail = converter;
+            }
+        }
+        line_number++;
+    }
+    free(line);
+    fclose(f);
+    free(path);
+    return head;
+}
+
+int converter_accepts
+(
+    const struct converter *converter,
+    const char *mime_type
+) {
+    const char *source_type = converter->source_type;
+    if (strcmp(source_type, "text") == 0) {
+        return mime_type_is_text(mime_type);
+    }
+    size_t length = strlen(source_type);
+    if (length >= 2 && strcmp(source_type + length - 2, "/*") == 0) {
+        return strncmp(mime_type, source_type, length - 1) == 0;
+    }
+    return strcmp(mime_type, source_type) == 0;
+}
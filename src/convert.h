@@ -0,0 +1,57 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WL_CLIPBOARD_CONVERT_H
+#define WL_CLIPBOARD_CONVERT_H
+
+// the converter registry: rules for producing additional representations
+// of the copied content, which wl-copy offers alongside the original one
+// and only produces once they're actually requested
+//
+// the rules are read from $XDG_CONFIG_HOME/wl-clipboard/converters,
+// one per line: a source type, a target type, and either a shell
+// command that reads the content on stdin and writes the converted
+// content to stdout, or the name of a built-in converter, such as
+//
+//     text/markdown  text/html   pandoc -f markdown -t html
+//     image/png      image/jpeg  convert png:- jpeg:-
+//     text           STRING      @latin1
+//
+// a source type of "text" matches all textual types, and one ending
+// in "/*" matches all the types with that prefix
+
+enum converter_kind {
+    CONVERTER_COMMAND,
+    // UTF-8 to ISO 8859-1
+    CONVERTER_LATIN1
+};
+
+struct converter {
+    char *source_type;
+    char *target_type;
+    enum converter_kind kind;
+    char *command;
+    struct converter *next;
+};
+
+// returns the built-in rules followed by the configured ones
+struct converter *load_converters(void);
+
+int converter_accepts(const struct converter *converter, const char *mime_type);
+
+#endif
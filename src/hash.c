@@ -0,0 +1,159 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hash.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotate_left(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t read_u64(const unsigned char *ptr) {
+    uint64_t value;
+    // the compiler turns this into a single load
+    // on little-endian machines
+    memcpy(&value, ptr, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+static uint32_t read_u32(const unsigned char *ptr) {
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static uint64_t round_step(uint64_t accumulator, uint64_t input) {
+    accumulator += input * PRIME64_2;
+    accumulator = rotate_left(accumulator, 31);
+    return accumulator * PRIME64_1;
+}
+
+static uint64_t merge_round(uint64_t hash, uint64_t accumulator) {
+    hash ^= round_step(0, accumulator);
+    return hash * PRIME64_1 + PRIME64_4;
+}
+
+static void consume_stripe(uint64_t *accumulators, const unsigned char *ptr) {
+    for (int i = 0; i < 4; i++) {
+        accumulators[i] = round_step(accumulators[i], read_u64(ptr + i * 8));
+    }
+}
+
+void hash_init(struct hash_state *state) {
+    memset(state, 0, sizeof(*state));
+    state->accumulators[0] = PRIME64_1 + PRIME64_2;
+    state->accumulators[1] = PRIME64_2;
+    state->accumulators[2] = 0;
+    state->accumulators[3] = -PRIME64_1;
+}
+
+void hash_update(struct hash_state *state, const void *data, size_t size) {
+    const unsigned char *ptr = data;
+    const unsigned char *end = ptr + size;
+    state->total_size += size;
+
+    if (state->buffered + size < sizeof(state->buffer)) {
+        memcpy(state->buffer + state->buffered, ptr, size);
+        state->buffered += size;
+        return;
+    }
+
+    if (state->buffered > 0) {
+        size_t to_fill = sizeof(state->buffer) - state->buffered;
+        memcpy(state->buffer + state->buffered, ptr, to_fill);
+        consume_stripe(state->accumulators, state->buffer);
+        ptr += to_fill;
+        state->buffered = 0;
+    }
+
+    for (; end - ptr >= 32; ptr += 32) {
+        consume_stripe(state->accumulators, ptr);
+    }
+
+    memcpy(state->buffer, ptr, end - ptr);
+    state->buffered = end - ptr;
+}
+
+uint64_t hash_digest(const struct hash_state *state) {
+    const uint64_t *acc = state->accumulators;
+    uint64_t hash;
+
+    if (state->total_size >= 32) {
+        hash = rotate_left(acc[0], 1) + rotate_left(acc[1], 7)
+            + rotate_left(acc[2], 12) + rotate_left(acc[3], 18);
+        for (int i = 0; i < 4; i++) {
+            hash = merge_round(hash, acc[i]);
+        }
+    } else {
+        hash = PRIME64_5;
+    }
+    hash += state->total_size;
+
+    const unsigned char *ptr = state->buffer;
+    const unsigned char *end = ptr + state->buffered;
+    for (; end - ptr >= 8; ptr += 8) {
+        hash ^= round_step(0, read_u64(ptr));
+        hash = rotate_left(hash, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (end - ptr >= 4) {
+        hash ^= (uint64_t) read_u32(ptr) * PRIME64_1;
+        hash = rotate_left(hash, 23) * PRIME64_2 + PRIME64_3;
+        ptr += 4;
+    }
+    for (; ptr < end; ptr++) {
+        hash ^= *ptr * PRIME64_5;
+        hash = rotate_left(hash, 11) * PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+void format_fingerprint(uint64_t hash, char buffer[FINGERPRINT_LENGTH + 1]) {
+    snprintf(buffer, FINGERPRINT_LENGTH + 1, "%016" PRIx64, hash);
+}
+
+int parse_fingerprint(const char *string, uint64_t *hash) {
+    if (strlen(string) != FINGERPRINT_LENGTH) {
+        return 0;
+    }
+    int consumed;
+    if (sscanf(string, "%" SCNx64 "%n", hash, &consumed) != 1) {
+        return 0;
+    }
+    return consumed == FINGERPRINT_LENGTH;
+}
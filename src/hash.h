@@ -0,0 +1,44 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WL_CLIPBOARD_HASH_H
+#define WL_CLIPBOARD_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// a streaming implementation of XXH64, a fast non-cryptographic
+// hash function; used to fingerprint the clipboard content
+
+struct hash_state {
+    uint64_t total_size;
+    uint64_t accumulators[4];
+    unsigned char buffer[32];
+    size_t buffered;
+};
+
+void hash_init(struct hash_state *state);
+void hash_update(struct hash_state *state, const void *data, size_t size);
+uint64_t hash_digest(const struct hash_state *state);
+
+// fingerprints are printed as 16 hex digits
+#define FINGERPRINT_LENGTH 16
+void format_fingerprint(uint64_t hash, char buffer[FINGERPRINT_LENGTH + 1]);
+int parse_fingerprint(const char *string, uint64_t *hash);
+
+#endif
@@ -0,0 +1,315 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "loop.h"
+
+#include <wayland-client.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+enum watch_kind {
+    WATCH_FD,
+    WATCH_TIMER,
+    WATCH_SIGNALS,
+    WATCH_DISPLAY
+};
+
+struct loop_watch {
+    enum watch_kind kind;
+    int fd;
+    void (*fd_handler)(void *data, int fd, uint32_t events);
+    void (*timer_handler)(void *data);
+    void *data;
+    // set when removed while its events are being dispatched
+    int removed;
+    struct loop_watch *next_removed;
+};
+
+static int epoll_fd = -1;
+static int should_quit;
+
+static struct loop_watch *signal_watch;
+static sigset_t signal_mask;
+static void (*signal_handlers[NSIG])(int signal_number);
+
+// watches removed during an iteration are only freed after it,
+// since there may still be pending events pointing to them
+static struct loop_watch *removed_watches;
+static int dispatching;
+
+#define MAX_EVENTS 32
+
+static void ensure_initialized() {
+    if (epoll_fd >= 0) {
+        return;
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+    sigemptyset(&signal_mask);
+}
+
+static struct loop_watch *add_watch
+(
+    enum watch_kind kind,
+    int fd,
+    uint32_t events
+) {
+    ensure_initialized();
+    struct loop_watch *watch = calloc(1, sizeof(struct loop_watch));
+    watch->kind = kind;
+    watch->fd = fd;
+    struct epoll_event event = {
+        .events = events,
+        .data.ptr = watch
+    };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+    return watch;
+}
+
+struct loop_watch *loop_add_fd
+(
+    int fd,
+    uint32_t events,
+    void (*handler)(void *data, int fd, uint32_t events),
+    void *data
+) {
+    struct loop_watch *watch = add_watch(WATCH_FD, fd, events);
+    watch->fd_handler = handler;
+    watch->data = data;
+    return watch;
+}
+
+void loop_modify_fd(struct loop_watch *watch, uint32_t events) {
+    struct epoll_event event = {
+        .events = events,
+        .data.ptr = watch
+    };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, watch->fd, &event) < 0) {
+        perror("epoll_ctl");
+    }
+}
+
+struct loop_watch *loop_add_timer(void (*handler)(void *data), void *data) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        perror("timerfd_create");
+        exit(1);
+    }
+    struct loop_watch *watch = add_watch(WATCH_TIMER, fd, EPOLLIN);
+    watch->timer_handler = handler;
+    watch->data = data;
+    return watch;
+}
+
+void loop_arm_timer(struct loop_watch *watch, uint64_t timeout_ns) {
+    struct itimerspec spec = {
+        .it_value = {
+            .tv_sec = timeout_ns / 1000000000,
+            .tv_nsec = timeout_ns % 1000000000
+        }
+    };
+    timerfd_settime(watch->fd, 0, &spec, NULL);
+}
+
+void loop_add_signal(int signal_number, void (*handler)(int signal_number)) {
+    ensure_initialized();
+    signal_handlers[signal_number] = handler;
+    sigaddset(&signal_mask, signal_number);
+    sigprocmask(SIG_BLOCK, &signal_mask, NULL);
+
+    int fd = signalfd(
+        signal_watch != NULL ? signal_watch->fd : -1,
+        &signal_mask,
+        SFD_NONBLOCK | SFD_CLOEXEC
+    );
+    if (fd < 0) {
+        perror("signalfd");
+        exit(1);
+    }
+    if (signal_watch == NULL) {
+        signal_watch = add_watch(WATCH_SIGNALS, fd, EPOLLIN);
+    }
+}
+
+void loop_remove(struct loop_watch *watch) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, watch->fd, NULL);
+    if (watch->kind == WATCH_TIMER) {
+        close(watch->fd);
+    }
+    if (dispatching) {
+        watch->removed = 1;
+        watch->next_removed = removed_watches;
+        removed_watches = watch;
+    } else {
+        free(watch);
+    }
+}
+
+void loop_quit() {
+    should_quit = 1;
+}
+
+static void dispatch_signals() {
+    struct signalfd_siginfo info;
+    while (read(signal_watch->fd, &info, sizeof(info)) == sizeof(info)) {
+        int signal_number = info.ssi_signo;
+        if (signal_number < NSIG && signal_handlers[signal_number] != NULL) {
+            signal_handlers[signal_number](signal_number);
+        }
+    }
+}
+
+static void dispatch_timer(struct loop_watch *watch) {
+    uint64_t expirations;
+    if (read(watch->fd, &expirations, sizeof(expirations)) > 0) {
+        watch->timer_handler(watch->data);
+    }
+}
+
+// frees the watches removed while dispatching, now that no events
+// can point to them anymore
+static void finish_dispatching() {
+    dispatching = 0;
+    while (removed_watches != NULL) {
+        struct loop_watch *next = removed_watches->next_removed;
+        free(removed_watches);
+        removed_watches = next;
+    }
+}
+
+int loop_run(struct wl_display *display) {
+    struct loop_watch *display_watch = add_watch(
+        WATCH_DISPLAY,
+        wl_display_get_fd(display),
+        EPOLLIN
+    );
+    int display_wants_write = 0;
+    int res = 0;
+
+    should_quit = 0;
+    while (!should_quit) {
+        // dispatch what's already queued, then make sure nobody else
+        // reads from the connection between now and epoll_wait()
+        while (wl_display_prepare_read(display) != 0) {
+            if (wl_display_dispatch_pending(display) < 0) {
+                res = -1;
+                goto out;
+            }
+        }
+        if (should_quit) {
+            wl_display_cancel_read(display);
+            break;
+        }
+
+        // send out our requests; if the socket is full,
+        // wait for it to become writable again
+        int flush_res = wl_display_flush(display);
+        if (flush_res < 0 && errno != EAGAIN) {
+            wl_display_cancel_read(display);
+            res = -1;
+            goto out;
+        }
+        int wants_write = flush_res < 0;
+        if (wants_write != display_wants_write) {
+            loop_modify_fd(
+                display_watch,
+                wants_write ? EPOLLIN | EPOLLOUT : EPOLLIN
+            );
+            display_wants_write = wants_write;
+        }
+
+        struct epoll_event events[MAX_EVENTS];
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            wl_display_cancel_read(display);
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            res = -1;
+            goto out;
+        }
+
+        // from here on, watches removed by any of the handlers
+        // (Wayland ones included) may still have events pending
+        dispatching = 1;
+
+        // the read has to be completed or cancelled before dispatching
+        // anything, as handlers are free to make roundtrips
+        int display_readable = 0;
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == display_watch) {
+                display_readable = events[i].events &
+                    (EPOLLIN | EPOLLERR | EPOLLHUP);
+            }
+        }
+        if (display_readable) {
+            if (wl_display_read_events(display) < 0) {
+                res = -1;
+                goto out;
+            }
+        } else {
+            wl_display_cancel_read(display);
+        }
+        if (wl_display_dispatch_pending(display) < 0) {
+            res = -1;
+            goto out;
+        }
+
+        for (int i = 0; i < count && !should_quit; i++) {
+            struct loop_watch *watch = events[i].data.ptr;
+            if (watch->removed) {
+                continue;
+            }
+            switch (watch->kind) {
+            case WATCH_FD:
+                watch->fd_handler(watch->data, watch->fd, events[i].events);
+                break;
+            case WATCH_TIMER:
+                dispatch_timer(watch);
+                break;
+            case WATCH_SIGNALS:
+                dispatch_signals();
+                break;
+            case WATCH_DISPLAY:
+                // reading has been taken care of above, and
+                // writing will be retried on the next iteration
+                break;
+            }
+        }
+        finish_dispatching();
+    }
+
+out:
+    // every way out goes through here, so that nothing is left
+    // queued for removal and the display isn't watched anymore
+    finish_dispatching();
+    loop_remove(display_watch);
+    return res;
+}
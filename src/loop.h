@@ -0,0 +1,57 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WL_CLIPBOARD_LOOP_H
+#define WL_CLIPBOARD_LOOP_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+struct wl_display;
+
+// the event loop both tools run on: Wayland events, file descriptors,
+// timers and signals, all multiplexed with epoll on a single thread
+
+struct loop_watch;
+
+// events are EPOLLIN, EPOLLOUT and friends
+struct loop_watch *loop_add_fd(
+    int fd,
+    uint32_t events,
+    void (*handler)(void *data, int fd, uint32_t events),
+    void *data
+);
+void loop_modify_fd(struct loop_watch *watch, uint32_t events);
+
+// timers start disarmed; arming an armed timer re-arms it,
+// and a timeout of zero disarms it
+struct loop_watch *loop_add_timer(void (*handler)(void *data), void *data);
+void loop_arm_timer(struct loop_watch *watch, uint64_t timeout_ns);
+
+// the signal gets blocked and is delivered through the loop instead
+void loop_add_signal(int signal_number, void (*handler)(int signal_number));
+
+// stops watching and frees the watch; doesn't close the fd
+void loop_remove(struct loop_watch *watch);
+
+// dispatches events until loop_quit() is called or
+// the Wayland connection fails; returns -1 in the latter case
+int loop_run(struct wl_display *display);
+void loop_quit(void);
+
+#endif
@@ -0,0 +1,175 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "meta.h"
+#include "hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+// appends a type to the newline-separated list
+static int append_type(struct clipboard_meta *meta, const char *mime_type) {
+    size_t used = strlen(meta->types);
+    size_t length = strlen(mime_type);
+    if (length == 0 || strchr(mime_type, '\n') != NULL) {
+        return 0;
+    }
+    if (used + length + 2 > sizeof(meta->types)) {
+        return 0;
+    }
+    if (used > 0) {
+        meta->types[used++] = '\n';
+    }
+    memcpy(meta->types + used, mime_type, length + 1);
+    return 1;
+}
+
+int set_clipboard_meta_types(
+    struct clipboard_meta *meta,
+    const char **types,
+    size_t count
+) {
+    meta->types[0] = '\0';
+    for (size_t i = 0; i < count; i++) {
+        if (!append_type(meta, types[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int clipboard_meta_has_type(
+    const struct clipboard_meta *meta,
+    const char *mime_type
+) {
+    size_t length = strlen(mime_type);
+    const char *type = meta->types;
+    while (*type != '\0') {
+        const char *end = type + strcspn(type, "\n");
+        if ((size_t) (end - type) == length) {
+            if (memcmp(type, mime_type, length) == 0) {
+                return 1;
+            }
+        }
+        type = *end == '\n' ? end + 1 : end;
+    }
+    return 0;
+}
+
+ssize_t format_clipboard_meta(
+    const struct clipboard_meta *meta,
+    char *buffer,
+    size_t size
+) {
+    size_t used = 0;
+    const char *type = meta->types;
+    while (*type != '\0') {
+        const char *end = type + strcspn(type, "\n");
+        int length = snprintf(
+            buffer + used, size - used,
+            "type=%.*s\n", (int) (end - type), type
+        );
+        if (length < 0 || (size_t) length >= size - used) {
+            return -1;
+        }
+        used += length;
+        type = *end == '\n' ? end + 1 : end;
+    }
+
+    char fingerprint[FINGERPRINT_LENGTH + 1];
+    format_fingerprint(meta->hash, fingerprint);
+    int length = snprintf(
+        buffer + used, size - used,
+        "size=%jd\nhash=%s\ntime=%" PRIu64 "\n",
+        (intmax_t) meta->size, fingerprint, meta->time_ms
+    );
+    if (length < 0 || (size_t) length >= size - used) {
+        return -1;
+    }
+    return used + length;
+}
+
+static int parse_number(const char *string, uint64_t *result) {
+    if (*string < '0' || *string > '9') {
+        return 0;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(string, &end, 10);
+    if (errno != 0 || *end != '\0') {
+        return 0;
+    }
+    *result = value;
+    return 1;
+}
+
+int parse_clipboard_meta(
+    const char *text,
+    size_t length,
+    struct clipboard_meta *meta
+) {
+    int have_size = 0, have_hash = 0, have_time = 0;
+    char line[CLIPBOARD_META_MAX_SIZE];
+    meta->types[0] = '\0';
+
+    while (length > 0) {
+        const char *newline = memchr(text, '\n', length);
+        size_t line_length = newline ? (size_t) (newline - text) : length;
+        size_t consumed = newline ? line_length + 1 : line_length;
+        if (line_length >= sizeof(line)) {
+            return 0;
+        }
+        memcpy(line, text, line_length);
+        line[line_length] = '\0';
+        text += consumed;
+        length -= consumed;
+
+        char *value = strchr(line, '=');
+        if (value == NULL) {
+            continue;
+        }
+        *value++ = '\0';
+
+        uint64_t number;
+        if (strcmp(line, "type") == 0) {
+            if (!append_type(meta, value)) {
+                return 0;
+            }
+        } else if (strcmp(line, "size") == 0) {
+            if (!parse_number(value, &number) || number > INT64_MAX) {
+                return 0;
+            }
+            meta->size = (off_t) number;
+            have_size = 1;
+        } else if (strcmp(line, "hash") == 0) {
+            if (!parse_fingerprint(value, &meta->hash)) {
+                return 0;
+            }
+            have_hash = 1;
+        } else if (strcmp(line, "time") == 0) {
+            if (!parse_number(value, &meta->time_ms)) {
+                return 0;
+            }
+            have_time = 1;
+        }
+    }
+
+    return meta->types[0] != '\0' && have_size && have_hash && have_time;
+}
@@ -0,0 +1,80 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WL_CLIPBOARD_META_H
+#define WL_CLIPBOARD_META_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// wl-copy can offer a description of what it copied as a type of its
+// own, so that wl-paste can learn about the content without having to
+// transfer it first; it is plain text, one key=value pair per line:
+//
+//     type=text/plain
+//     type=text/plain;charset=utf-8
+//     size=1234
+//     hash=0123456789abcdef
+//     time=1760000000123
+//
+// the types listed are the ones the content is offered as-is in, the
+// size and the hash (its fingerprint) describe the content in those
+// types, and the time is when it was copied, in milliseconds since the
+// epoch; unknown keys are ignored, so that more can be added later
+
+#define clipboard_meta_type "application/x-wl-clipboard-meta"
+
+// nobody needs a description larger than this
+#define CLIPBOARD_META_MAX_SIZE 4096
+
+struct clipboard_meta {
+    // the types, separated by newlines
+    char types[1024];
+    off_t size;
+    uint64_t hash;
+    uint64_t time_ms;
+};
+
+// fills in the types from the given list, returns 0 if they don't fit
+int set_clipboard_meta_types(
+    struct clipboard_meta *meta,
+    const char **types,
+    size_t count
+);
+
+// whether the description applies to the content of the given type
+int clipboard_meta_has_type(
+    const struct clipboard_meta *meta,
+    const char *mime_type
+);
+
+// returns the length of the text, or -1 if it does not fit
+ssize_t format_clipboard_meta(
+    const struct clipboard_meta *meta,
+    char *buffer,
+    size_t size
+);
+
+// returns 0 unless all the fields are present and well-formed
+int parse_clipboard_meta(
+    const char *text,
+    size_t length,
+    struct clipboard_meta *meta
+);
+
+#endif
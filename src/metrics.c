@@ -0,0 +1,264 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <limits.h> // PATH_MAX
+#include <sys/stat.h>
+
+const char *metrics_file_path = NULL;
+
+// identifies the file we last put at metrics_file_path, so that we can tell
+// when a newer wl-copy writing to the same path has replaced it
+static int wrote_file = 0;
+static dev_t written_dev;
+static ino_t written_ino;
+
+// clients can request types we haven't offered; don't let
+// them make us track an unbounded number of label values
+#define MAX_TYPES 32
+
+// upper bounds of the latency histogram buckets, in seconds
+static const double buckets[] = {
+    0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 60
+};
+#define BUCKET_COUNT (sizeof(buckets) / sizeof(buckets[0]))
+
+static struct {
+    off_t payload_size;
+    uint64_t in_flight;
+    struct {
+        char *mime_type;
+        uint64_t requests;
+        uint64_t failures;
+        uint64_t bytes;
+    } types[MAX_TYPES + 1];
+    int type_count;
+    uint64_t bucket_counts[BUCKET_COUNT];
+    uint64_t duration_count;
+    double duration_sum;
+} metrics;
+
+void metrics_set_payload_size(off_t size) {
+    metrics.payload_size = size;
+}
+
+void metrics_transfer_started() {
+    metrics.in_flight++;
+    metrics_write();
+}
+
+static int index_for_type(const char *mime_type) {
+    for (int i = 0; i < metrics.type_count; i++) {
+        if (strcmp(metrics.types[i].mime_type, mime_type) == 0) {
+            return i;
+        }
+    }
+    if (metrics.type_count < MAX_TYPES) {
+        metrics.types[metrics.type_count].mime_type = strdup(mime_type);
+        return metrics.type_count++;
+    }
+    // the last slot collects all the others
+    if (metrics.types[MAX_TYPES].mime_type == NULL) {
+        metrics.types[MAX_TYPES].mime_type = strdup("other");
+    }
+    return MAX_TYPES;
+}
+
+void metrics_transfer_finished
+(
+    const char *mime_type,
+    off_t size,
+    uint64_t duration,
+    int succeeded
+) {
+    metrics.in_flight--;
+
+    int i = index_for_type(mime_type);
+    metrics.types[i].requests++;
+    metrics.types[i].bytes += size;
+    if (!succeeded) {
+        metrics.types[i].failures++;
+    }
+
+    double seconds = duration / 1e9;
+    for (size_t b = 0; b < BUCKET_COUNT; b++) {
+        if (seconds <= buckets[b]) {
+            metrics.bucket_counts[b]++;
+        }
+    }
+    metrics.duration_count++;
+    metrics.duration_sum += seconds;
+
+    metrics_write();
+}
+
+static void print_label_value(FILE *f, const char *value) {
+    for (const char *ptr = value; *ptr; ptr++) {
+        if (*ptr == '\\' || *ptr == '"') {
+            fprintf(f, "\\%c", *ptr);
+        } else if (*ptr == '\n') {
+            fprintf(f, "\\n");
+        } else {
+            fputc(*ptr, f);
+        }
+    }
+}
+
+enum per_type_counter {
+    REQUESTS,
+    FAILURES,
+    BYTES
+};
+
+static void print_per_type
+(
+    FILE *f,
+    const char *name,
+    enum per_type_counter counter
+) {
+    int total = metrics.type_count;
+    if (metrics.types[MAX_TYPES].mime_type != NULL) {
+        total = MAX_TYPES + 1;
+    }
+    for (int i = 0; i < total; i++) {
+        if (metrics.types[i].mime_type == NULL) {
+            continue;
+        }
+        uint64_t value = metrics.types[i].requests;
+        if (counter == FAILURES) {
+            value = metrics.types[i].failures;
+        } else if (counter == BYTES) {
+            value = metrics.types[i].bytes;
+        }
+        fprintf(f, "%s{type=\"", name);
+        print_label_value(f, metrics.types[i].mime_type);
+        fprintf(f, "\"} %" PRIu64 "\n", value);
+    }
+}
+
+static int file_is_ours() {
+    struct stat st;
+    if (stat(metrics_file_path, &st) < 0) {
+        return 0;
+    }
+    return st.st_dev == written_dev && st.st_ino == written_ino;
+}
+
+void metrics_write() {
+    if (metrics_file_path == NULL) {
+        return;
+    }
+    // the file belongs to whoever has replaced it now
+    if (wrote_file && !file_is_ours()) {
+        return;
+    }
+
+    // write into a temporary file and rename it over the old one,
+    // so that the scraper never sees a partially written file
+    char temp_path[PATH_MAX];
+    snprintf(
+        temp_path,
+        sizeof(temp_path),
+        "%s.%ld.tmp",
+        metrics_file_path,
+        (long) getpid()
+    );
+    FILE *f = fopen(temp_path, "w");
+    if (f == NULL) {
+        perror("open metrics file");
+        return;
+    }
+
+    fprintf(f,
+        "# HELP wl_copy_requests_total Paste requests served.\n"
+        "# TYPE wl_copy_requests_total counter\n");
+    print_per_type(f, "wl_copy_requests_total", REQUESTS);
+    fprintf(f,
+        "# HELP wl_copy_failed_requests_total"
+        " Paste requests that failed, e.g. because the client went away.\n"
+        "# TYPE wl_copy_failed_requests_total counter\n");
+    print_per_type(f, "wl_copy_failed_requests_total", FAILURES);
+    fprintf(f,
+        "# HELP wl_copy_sent_bytes_total Bytes sent to pasting clients.\n"
+        "# TYPE wl_copy_sent_bytes_total counter\n");
+    print_per_type(f, "wl_copy_sent_bytes_total", BYTES);
+
+    fprintf(f,
+        "# HELP wl_copy_request_duration_seconds"
+        " Time taken to serve a paste request.\n"
+        "# TYPE wl_copy_request_duration_seconds histogram\n");
+    for (size_t b = 0; b < BUCKET_COUNT; b++) {
+        fprintf(
+            f,
+            "wl_copy_request_duration_seconds_bucket{le=\"%g\"} %" PRIu64 "\n",
+            buckets[b],
+            metrics.bucket_counts[b]
+        );
+    }
+    fprintf(
+        f,
+        "wl_copy_request_duration_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n"
+        "wl_copy_request_duration_seconds_sum %.9f\n"
+        "wl_copy_request_duration_seconds_count %" PRIu64 "\n",
+        metrics.duration_count,
+        metrics.duration_sum,
+        metrics.duration_count
+    );
+
+    fprintf(
+        f,
+        "# HELP wl_copy_requests_in_flight"
+        " Paste requests currently being served.\n"
+        "# TYPE wl_copy_requests_in_flight gauge\n"
+        "wl_copy_requests_in_flight %" PRIu64 "\n"
+        "# HELP wl_copy_payload_bytes Size of the copied content.\n"
+        "# TYPE wl_copy_payload_bytes gauge\n"
+        "wl_copy_payload_bytes %lld\n",
+        metrics.in_flight,
+        (long long) metrics.payload_size
+    );
+
+    struct stat st;
+    int stat_failed = fstat(fileno(f), &st) < 0;
+    if (fclose(f) != 0 || stat_failed) {
+        perror("write metrics file");
+        unlink(temp_path);
+        return;
+    }
+    if (rename(temp_path, metrics_file_path) < 0) {
+        perror("rename metrics file");
+        unlink(temp_path);
+        return;
+    }
+    wrote_file = 1;
+    written_dev = st.st_dev;
+    written_ino = st.st_ino;
+}
+
+void metrics_remove() {
+    // don't remove the file a newer wl-copy has written in its place
+    if (metrics_file_path != NULL && wrote_file && file_is_ours()) {
+        unlink(metrics_file_path);
+    }
+}
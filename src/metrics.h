@@ -0,0 +1,44 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WL_CLIPBOARD_METRICS_H
+#define WL_CLIPBOARD_METRICS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// --metrics-file support: counters about the paste requests a
+// long-running wl-copy serves, kept in the Prometheus text format
+// so that node exporter's textfile collector can pick them up
+
+extern const char *metrics_file_path;
+
+void metrics_set_payload_size(off_t size);
+void metrics_transfer_started(void);
+// duration is in nanoseconds
+void metrics_transfer_finished(
+    const char *mime_type,
+    off_t size,
+    uint64_t duration,
+    int succeeded
+);
+// rewrites the metrics file with the current values
+void metrics_write(void);
+void metrics_remove(void);
+
+#endif
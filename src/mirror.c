@@ -0,0 +1,406 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "boilerplate.h"
+
+#ifdef HAVE_WLR_DATA_CONTROL
+
+// an offer of one of the selections, kept around for
+// as long as any of our sources is passing it on
+struct mirrored_offer {
+    struct zwlr_data_control_offer_v1 *proxy;
+    struct wl_display *display;
+    char **types;
+    size_t count;
+    int refcount;
+};
+
+struct mirror_endpoint {
+    struct mirror_device *device;
+    int primary;
+    struct mirror_endpoint **targets;
+    size_t target_count;
+    uint64_t debounce_ns;
+    struct loop_watch *timer;
+    // the latest change, while waiting for things to settle down
+    struct mirrored_offer *pending;
+    // the source we've set as this selection, as long as it is one
+    struct zwlr_data_control_source_v1 *own_source;
+};
+
+struct mirror_device {
+    struct wl_display *display;
+    struct zwlr_data_control_manager_v1 *manager;
+    struct zwlr_data_control_device_v1 *device;
+    struct mirror_endpoint regular;
+    struct mirror_endpoint primary;
+    // whether we're still receiving the selections the device started with
+    int starting;
+};
+
+// our source passing paste requests on to the mirrored offer
+struct proxy_source {
+    struct mirror_endpoint *endpoint;
+    struct mirrored_offer *offer;
+};
+
+static void unref_offer(struct mirrored_offer *offer) {
+    if (offer == NULL || --offer->refcount > 0) {
+        return;
+    }
+    zwlr_data_control_offer_v1_destroy(offer->proxy);
+    for (size_t i = 0; i < offer->count; i++) {
+        free(offer->types[i]);
+    }
+    free(offer->types);
+    free(offer);
+}
+
+static void proxy_source_send
+(
+    void *data,
+    struct zwlr_data_control_source_v1 *source,
+    const char *mime_type,
+    int fd
+) {
+    struct proxy_source *proxy_source = data;
+    struct mirrored_offer *offer = proxy_source->offer;
+    // the owner of the mirrored selection
+    // writes the data straight to the paster
+    trace_probe(send_start, mime_type, fd);
+    zwlr_data_control_offer_v1_receive(offer->proxy, mime_type, fd);
+    wl_display_flush(offer->display);
+    close(fd);
+}
+
+static void proxy_source_cancelled
+(
+    void *data,
+    struct zwlr_data_control_source_v1 *source
+) {
+    struct proxy_source *proxy_source = data;
+    if (proxy_source->endpoint->own_source == source) {
+        proxy_source->endpoint->own_source = NULL;
+    }
+    unref_offer(proxy_source->offer);
+    zwlr_data_control_source_v1_destroy(source);
+    free(proxy_source);
+}
+
+static const struct zwlr_data_control_source_v1_listener
+proxy_source_listener = {
+    .send = proxy_source_send,
+    .cancelled = proxy_source_cancelled
+};
+
+static void set_mirrored_offer
+(
+    struct mirror_endpoint *endpoint,
+    struct mirrored_offer *offer
+) {
+    struct mirror_device *device = endpoint->device;
+    struct proxy_source *proxy_source = calloc(
+        1,
+        sizeof(struct proxy_source)
+    );
+    proxy_source->endpoint = endpoint;
+    proxy_source->offer = offer;
+    offer->refcount++;
+
+    struct zwlr_data_control_source_v1 *source =
+        zwlr_data_control_manager_v1_create_data_source(device->manager);
+    zwlr_data_control_source_v1_add_listener(
+        source,
+        &proxy_source_listener,
+        proxy_source
+    );
+    for (size_t i = 0; i < offer->count; i++) {
+        zwlr_data_control_source_v1_offer(source, offer->types[i]);
+    }
+
+    // the source we're replacing gets cancelled before we're sent
+    // the new selection, so until then, the selection is our own
+    endpoint->own_source = source;
+    if (endpoint->primary) {
+        zwlr_data_control_device_v1_set_primary_selection(
+            device->device,
+            source
+        );
+    } else {
+        zwlr_data_control_device_v1_set_selection(device->device, source);
+    }
+    wl_display_flush(device->display);
+}
+
+static void propagate_pending(void *data) {
+    struct mirror_endpoint *endpoint = data;
+    struct mirrored_offer *offer = endpoint->pending;
+    endpoint->pending = NULL;
+    if (offer == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < endpoint->target_count; i++) {
+        set_mirrored_offer(endpoint->targets[i], offer);
+    }
+    unref_offer(offer);
+}
+
+static void offer_offer
+(
+    void *data,
+    struct zwlr_data_control_offer_v1 *proxy,
+    const char *mime_type
+) {
+    struct mirrored_offer *offer = data;
+    offer->types = realloc(offer->types, (offer->count + 1) * sizeof(char *));
+    offer->types[offer->count++] = strdup(mime_type);
+}
+
+static const struct zwlr_data_control_offer_v1_listener offer_listener = {
+    .offer = offer_offer
+};
+
+static void device_data_offer
+(
+    void *data,
+    struct zwlr_data_control_device_v1 *device,
+    struct zwlr_data_control_offer_v1 *proxy
+) {
+    struct mirror_device *mirror_device = data;
+    struct mirrored_offer *offer = calloc(1, sizeof(struct mirrored_offer));
+    offer->proxy = proxy;
+    offer->display = mirror_device->display;
+    // until the selection event, which hands the reference over
+    offer->refcount = 1;
+    zwlr_data_control_offer_v1_add_listener(proxy, &offer_listener, offer);
+}
+
+static void handle_selection
+(
+    struct mirror_endpoint *endpoint,
+    struct zwlr_data_control_offer_v1 *proxy
+) {
+    struct mirrored_offer *offer = NULL;
+    if (proxy != NULL) {
+        offer = zwlr_data_control_offer_v1_get_user_data(proxy);
+        if (offer == NULL) {
+            // introduced before we started listening
+            zwlr_data_control_offer_v1_destroy(proxy);
+        }
+    }
+    trace_probe(offer_received, proxy);
+
+    // an empty selection is not worth mirroring, and our own
+    // selection must not bounce back to where it came from
+    if (
+        offer == NULL ||
+        endpoint->device->starting ||
+        endpoint->own_source != NULL ||
+        endpoint->target_count == 0
+    ) {
+        unref_offer(offer);
+        return;
+    }
+
+    unref_offer(endpoint->pending);
+    endpoint->pending = offer;
+    if (endpoint->timer != NULL) {
+        loop_arm_timer(endpoint->timer, endpoint->debounce_ns);
+    } else {
+        propagate_pending(endpoint);
+    }
+}
+
+static void device_selection
+(
+    void *data,
+    struct zwlr_data_control_device_v1 *device,
+    struct zwlr_data_control_offer_v1 *proxy
+) {
+    struct mirror_device *mirror_device = data;
+    handle_selection(&mirror_device->regular, proxy);
+}
+
+static void device_primary_selection
+(
+    void *data,
+    struct zwlr_data_control_device_v1 *device,
+    struct zwlr_data_control_offer_v1 *proxy
+) {
+    struct mirror_device *mirror_device = data;
+    handle_selection(&mirror_device->primary, proxy);
+}
+
+static void device_finished
+(
+    void *data,
+    struct zwlr_data_control_device_v1 *device
+) {
+    bail("The seat is gone");
+}
+
+static const struct zwlr_data_control_device_v1_listener device_listener = {
+    .data_offer = device_data_offer,
+    .selection = device_selection,
+    .finished = device_finished,
+    .primary_selection = device_primary_selection
+};
+
+struct mirror_device *mirror_add_device
+(
+    struct wl_display *display,
+    struct zwlr_data_control_manager_v1 *manager,
+    struct zwlr_data_control_device_v1 *device
+) {
+    struct mirror_device *mirror_device = calloc(
+        1,
+        sizeof(struct mirror_device)
+    );
+    mirror_device->display = display;
+    mirror_device->manager = manager;
+    mirror_device->device = device;
+    mirror_device->regular.device = mirror_device;
+    mirror_device->primary.device = mirror_device;
+    mirror_device->primary.primary = 1;
+
+    zwlr_data_control_device_v1_add_listener(
+        device,
+        &device_listener,
+        mirror_device
+    );
+    // we get sent the current selections right away
+    mirror_device->starting = 1;
+    wl_display_roundtrip(display);
+    mirror_device->starting = 0;
+    return mirror_device;
+}
+
+// the globals of another display we've connected to
+struct remote_globals {
+    struct wl_seat *seat;
+    struct zwlr_data_control_manager_v1 *manager;
+};
+
+static void remote_global
+(
+    void *data,
+    struct wl_registry *registry,
+    uint32_t name,
+    const char *interface,
+    uint32_t version
+) {
+    struct remote_globals *globals = data;
+    if (strcmp(interface, "wl_seat") == 0 && globals->seat == NULL) {
+        globals->seat = wl_registry_bind(registry, name, &wl_seat_interface, 1);
+    } else if (strcmp(interface, "zwlr_data_control_manager_v1") == 0) {
+        globals->manager = wl_registry_bind(
+            registry,
+            name,
+            &zwlr_data_control_manager_v1_interface,
+            version < 2 ? version : 2
+        );
+    }
+}
+
+static void remote_global_remove
+(
+    void *data,
+    struct wl_registry *registry,
+    uint32_t name
+) {}
+
+static const struct wl_registry_listener remote_registry_listener = {
+    .global = remote_global,
+    .global_remove = remote_global_remove
+};
+
+static void dispatch_remote(void *data, int fd, uint32_t events) {
+    struct wl_display *display = data;
+    if (wl_display_dispatch(display) < 0) {
+        perror("wl_display_dispatch");
+        exit(1);
+    }
+    wl_display_flush(display);
+}
+
+struct mirror_device *mirror_connect(const char *display_name) {
+    struct wl_display *display = wl_display_connect(display_name);
+    if (display == NULL) {
+        return NULL;
+    }
+    struct remote_globals *globals = calloc(1, sizeof(struct remote_globals));
+    struct wl_registry *registry = wl_display_get_registry(display);
+    wl_registry_add_listener(registry, &remote_registry_listener, globals);
+    wl_display_roundtrip(display);
+    if (globals->seat == NULL || globals->manager == NULL) {
+        wl_display_disconnect(display);
+        return NULL;
+    }
+
+    struct zwlr_data_control_device_v1 *device =
+        zwlr_data_control_manager_v1_get_data_device(
+            globals->manager,
+            globals->seat
+        );
+    struct mirror_device *mirror_device = mirror_add_device(
+        display,
+        globals->manager,
+        device
+    );
+    loop_add_fd(
+        wl_display_get_fd(display),
+        EPOLLIN,
+        dispatch_remote,
+        display
+    );
+    return mirror_device;
+}
+
+struct mirror_endpoint *mirror_endpoint
+(
+    struct mirror_device *device,
+    int primary
+) {
+    if (!primary) {
+        return &device->regular;
+    }
+    if (zwlr_data_control_device_v1_get_version(device->device) < 2) {
+        return NULL;
+    }
+    return &device->primary;
+}
+
+void mirror_link
+(
+    struct mirror_endpoint *from,
+    struct mirror_endpoint *to,
+    uint64_t debounce_ns
+) {
+    from->targets = realloc(
+        from->targets,
+        (from->target_count + 1) * sizeof(struct mirror_endpoint *)
+    );
+    from->targets[from->target_count++] = to;
+    from->debounce_ns = debounce_ns;
+    if (debounce_ns > 0 && from->timer == NULL) {
+        from->timer = loop_add_timer(propagate_pending, from);
+    }
+}
+
+#endif
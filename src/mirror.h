@@ -0,0 +1,77 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef WL_CLIPBOARD_MIRROR_H
+#define WL_CLIPBOARD_MIRROR_H
+
+#include <stdint.h>
+
+// mirroring: whenever one selection changes, set another one to the same
+// offer, without receiving any of the content ourselves; only when somebody
+// pastes from the mirror is the original owner asked for the data, and it
+// then writes it straight to them
+//
+// the other selection can also be on another display, in which case the
+// owner of the original selection writes the data straight to a client
+// of another compositor
+//
+// this is built on wlr-data-control, which lets us watch and set both the
+// regular and, since version 2, the primary selection without having the
+// keyboard focus
+
+#ifdef HAVE_WLR_DATA_CONTROL
+
+struct wl_display;
+struct zwlr_data_control_manager_v1;
+struct zwlr_data_control_device_v1;
+
+struct mirror_device;
+struct mirror_endpoint;
+
+// starts tracking the selections of the device; the selections
+// the device already has when this is called are not mirrored
+struct mirror_device *mirror_add_device(
+    struct wl_display *display,
+    struct zwlr_data_control_manager_v1 *manager,
+    struct zwlr_data_control_device_v1 *device
+);
+
+// connects to another display and starts tracking the selections of its
+// first seat, dispatching its events on the loop; returns NULL if it can't
+// be connected to or doesn't support wlr-data-control
+struct mirror_device *mirror_connect(const char *display_name);
+
+// returns NULL for the primary selection if the device doesn't support it
+struct mirror_endpoint *mirror_endpoint(
+    struct mirror_device *device,
+    int primary
+);
+
+// makes the changes to one selection propagate to another, once the first
+// one has not changed for debounce_ns; changes made by the mirroring itself
+// never propagate any further, so two selections can mirror each other
+void mirror_link(
+    struct mirror_endpoint *from,
+    struct mirror_endpoint *to,
+    uint64_t debounce_ns
+);
+
+#endif
+
+#endif
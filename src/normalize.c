@@ -0,0 +1,355 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "normalize.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+// longer runs of whitespace are let through untrimmed
+#define MAX_HELD_WHITESPACE 4096
+
+struct normalizer {
+    struct normalize_options options;
+    int (*sink)(void *data, const char *buffer, size_t size);
+    void *sink_data;
+    int failed;
+
+    // bytes that need to go through the slow path
+    char special[5];
+    int special_count;
+
+    size_t column;
+    // trailing whitespace that gets dropped if the line ends here
+    char held[MAX_HELD_WHITESPACE];
+    size_t held_length;
+    // a carriage return that may be a part of a CRLF
+    int pending_cr;
+    // a newline that gets dropped if the data ends here
+    const char *pending_newline;
+
+    char output[OUTPUT_BUFFER_SIZE];
+    size_t output_length;
+};
+
+int normalize_options_active(const struct normalize_options *options) {
+    return options->trim_whitespace
+        || options->line_endings != LINE_ENDINGS_KEEP
+        || options->strip_nul
+        || options->tab_width > 0
+        || options->trim_final_newline;
+}
+
+int parse_line_endings(const char *string, enum line_endings *result) {
+    if (strcmp(string, "lf") == 0) {
+        *result = LINE_ENDINGS_LF;
+    } else if (strcmp(string, "crlf") == 0) {
+        *result = LINE_ENDINGS_CRLF;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+int parse_tab_width(const char *string, int *result) {
+    if (string == NULL) {
+        *result = 8;
+        return 1;
+    }
+    char *end;
+    long width = strtol(string, &end, 10);
+    if (*string == '\0' || *end != '\0' || width < 1 || width > 64) {
+        return 0;
+    }
+    *result = width;
+    return 1;
+}
+
+struct normalizer *normalizer_create
+(
+    const struct normalize_options *options,
+    int (*sink)(void *data, const char *buffer, size_t size),
+    void *data
+) {
+    struct normalizer *n = calloc(1, sizeof(struct normalizer));
+    n->options = *options;
+    n->sink = sink;
+    n->sink_data = data;
+
+    // newlines always matter, since they end lines and may be CRLFs
+    n->special[n->special_count++] = '\n';
+    n->special[n->special_count++] = '\r';
+    if (options->trim_whitespace) {
+        n->special[n->special_count++] = ' ';
+    }
+    if (options->trim_whitespace || options->tab_width > 0) {
+        n->special[n->special_count++] = '\t';
+    }
+    if (options->strip_nul) {
+        n->special[n->special_count++] = '\0';
+    }
+    return n;
+}
+
+static void flush_output(struct normalizer *n) {
+    if (n->output_length > 0 && !n->failed) {
+        n->failed = !n->sink(n->sink_data, n->output, n->output_length);
+    }
+    n->output_length = 0;
+}
+
+static void emit(struct normalizer *n, const char *data, size_t size) {
+    while (size > 0) {
+        if (n->output_length == OUTPUT_BUFFER_SIZE) {
+            flush_output(n);
+        }
+        size_t chunk = OUTPUT_BUFFER_SIZE - n->output_length;
+        if (chunk > size) {
+            chunk = size;
+        }
+        memcpy(n->output + n->output_length, data, chunk);
+        n->output_length += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+static void emit_spaces(struct normalizer *n, size_t count) {
+    static const char spaces[] = "                ";
+    while (count > 0) {
+        size_t chunk = count < sizeof(spaces) - 1 ? count : sizeof(spaces) - 1;
+        emit(n, spaces, chunk);
+        count -= chunk;
+    }
+}
+
+// emits whatever has been held back, now that the line continues
+static void release(struct normalizer *n) {
+    if (n->pending_newline != NULL) {
+        emit(n, n->pending_newline, strlen(n->pending_newline));
+        n->pending_newline = NULL;
+    }
+    if (n->held_length > 0) {
+        emit(n, n->held, n->held_length);
+        n->held_length = 0;
+    }
+}
+
+static size_t tab_stop_distance(struct normalizer *n) {
+    return n->options.tab_width - n->column % n->options.tab_width;
+}
+
+static void end_line(struct normalizer *n, int was_crlf) {
+    // trailing whitespace is dropped along with the line end
+    n->held_length = 0;
+    release(n);
+
+    const char *newline;
+    switch (n->options.line_endings) {
+    case LINE_ENDINGS_LF:
+        newline = "\n";
+        break;
+    case LINE_ENDINGS_CRLF:
+        newline = "\r\n";
+        break;
+    default:
+        newline = was_crlf ? "\r\n" : "\n";
+        break;
+    }
+    if (n->options.trim_final_newline) {
+        n->pending_newline = newline;
+    } else {
+        emit(n, newline, strlen(newline));
+    }
+    n->column = 0;
+}
+
+static void process_regular(struct normalizer *n, char c) {
+    release(n);
+    emit(n, &c, 1);
+    n->column++;
+}
+
+static void process_whitespace(struct normalizer *n, char c) {
+    size_t width = 1;
+    if (c == '\t' && n->options.tab_width > 0) {
+        width = tab_stop_distance(n);
+    }
+    if (!n->options.trim_whitespace) {
+        release(n);
+        if (c == '\t' && n->options.tab_width > 0) {
+            emit_spaces(n, width);
+        } else {
+            emit(n, &c, 1);
+        }
+        n->column += width;
+        return;
+    }
+
+    if (n->held_length + width > MAX_HELD_WHITESPACE) {
+        release(n);
+    }
+    if (n->held_length + width > MAX_HELD_WHITESPACE) {
+        // a single tab wider than the whole buffer
+        emit_spaces(n, width);
+    } else if (c == '\t' && n->options.tab_width > 0) {
+        memset(n->held + n->held_length, ' ', width);
+        n->held_length += width;
+    } else {
+        n->held[n->held_length++] = c;
+    }
+    n->column += width;
+}
+
+static void process_special(struct normalizer *n, char c) {
+    if (n->pending_cr) {
+        n->pending_cr = 0;
+        if (c == '\n') {
+            end_line(n, 1);
+            return;
+        }
+        // a lone carriage return is just a character
+        process_regular(n, '\r');
+    }
+
+    switch (c) {
+    case '\n':
+        end_line(n, 0);
+        break;
+    case '\r':
+        n->pending_cr = 1;
+        break;
+    case ' ':
+    case '\t':
+        process_whitespace(n, c);
+        break;
+    case '\0':
+        if (!n->options.strip_nul) {
+            process_regular(n, c);
+        }
+        break;
+    default:
+        process_regular(n, c);
+        break;
+    }
+}
+
+#define ONES 0x0101010101010101ULL
+#define HIGH_BITS 0x8080808080808080ULL
+
+// returns the length of the run of bytes that don't need any special
+// handling, looking at a whole machine word at a time
+static size_t plain_run_length
+(
+    struct normalizer *n,
+    const char *data,
+    size_t size
+) {
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        uint64_t found = 0;
+        for (int s = 0; s < n->special_count; s++) {
+            uint64_t x = word ^ (ONES * (unsigned char) n->special[s]);
+            found |= (x - ONES) & ~x & HIGH_BITS;
+        }
+        if (found) {
+            break;
+        }
+    }
+    for (; i < size; i++) {
+        if (memchr(n->special, data[i], n->special_count) != NULL) {
+            break;
+        }
+    }
+    return i;
+}
+
+// the number of characters in the run, not counting
+// UTF-8 continuation bytes, which don't take up a column
+static size_t run_width(const char *data, size_t size) {
+    size_t width = 0;
+    for (size_t i = 0; i < size; i++) {
+        width += ((unsigned char) data[i] & 0xC0) != 0x80;
+    }
+    return width;
+}
+
+int normalizer_feed(struct normalizer *n, const char *data, size_t size) {
+    size_t i = 0;
+    while (i < size && !n->failed) {
+        size_t run = plain_run_length(n, data + i, size - i);
+        if (run > 0) {
+            if (n->pending_cr) {
+                n->pending_cr = 0;
+                process_regular(n, '\r');
+            }
+            release(n);
+            emit(n, data + i, run);
+            if (n->options.tab_width > 0) {
+                n->column += run_width(data + i, run);
+            }
+            i += run;
+        }
+        if (i < size) {
+            process_special(n, data[i]);
+            i++;
+        }
+    }
+    return !n->failed;
+}
+
+int normalizer_finish(struct normalizer *n) {
+    if (n->pending_cr) {
+        process_regular(n, '\r');
+    }
+    // whatever is still held back is either trailing whitespace
+    // or the final newline, and both are meant to be dropped
+    flush_output(n);
+    int succeeded = !n->failed;
+    free(n);
+    return succeeded;
+}
+
+off_t normalize_fd(int fd, struct normalizer *n) {
+    char buffer[64 * 1024];
+    off_t total = 0;
+    while (1) {
+        ssize_t res = read(fd, buffer, sizeof(buffer));
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res < 0) {
+            perror("read");
+            return -1;
+        }
+        if (res == 0) {
+            return total;
+        }
+        if (!normalizer_feed(n, buffer, res)) {
+            return -1;
+        }
+        total += res;
+    }
+}
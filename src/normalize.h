@@ -0,0 +1,70 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WL_CLIPBOARD_NORMALIZE_H
+#define WL_CLIPBOARD_NORMALIZE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// a streaming text normalization stage: data is fed through it in
+// chunks of any size, and it only ever holds on to a few bytes, so
+// it works on arbitrarily large content in constant memory
+
+enum line_endings {
+    LINE_ENDINGS_KEEP,
+    LINE_ENDINGS_LF,
+    LINE_ENDINGS_CRLF
+};
+
+struct normalize_options {
+    // remove spaces and tabs from the ends of lines
+    int trim_whitespace;
+    enum line_endings line_endings;
+    int strip_nul;
+    // expand tabs to spaces with this tab width, or keep them if 0
+    int tab_width;
+    // drop the newline at the very end, if any
+    int trim_final_newline;
+};
+
+int normalize_options_active(const struct normalize_options *options);
+
+// parsers for the command-line options; these return 0 on failure
+int parse_line_endings(const char *string, enum line_endings *result);
+int parse_tab_width(const char *string, int *result);
+
+struct normalizer;
+
+// the sink gets the normalized data and returns 0 on failure
+struct normalizer *normalizer_create(
+    const struct normalize_options *options,
+    int (*sink)(void *data, const char *buffer, size_t size),
+    void *data
+);
+
+// these return 0 if the sink has failed; normalizer_finish()
+// flushes everything that's left and frees the normalizer
+int normalizer_feed(struct normalizer *n, const char *data, size_t size);
+int normalizer_finish(struct normalizer *n);
+
+// feeds all of the data from the file descriptor through the normalizer,
+// returns the number of bytes read, or -1 if reading or the sink failed
+off_t normalize_fd(int fd, struct normalizer *n);
+
+#endif
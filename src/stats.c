@@ -0,0 +1,186 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <limits.h> // INT_MAX
+#include <strings.h> // strcasecmp
+
+int stats_fd = -1;
+
+#define MAX_PHASES 32
+#define MAX_TRANSFERS 64
+
+static struct {
+    const char *program;
+    uint64_t start;
+    struct {
+        const char *name;
+        uint64_t time;
+    } phases[MAX_PHASES];
+    int phase_count;
+    struct {
+        char *mime_type;
+        off_t size;
+        uint64_t start;
+        uint64_t end;
+    } transfers[MAX_TRANSFERS];
+    int transfer_count;
+} stats;
+
+uint64_t stats_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_enable(const char *program, const char *spec) {
+    stats_fd = STDERR_FILENO;
+    // a bare number is more likely to mean "yes" than a file
+    // descriptor, and stdout may well be carrying pasted data
+    if (spec != NULL && strncmp(spec, "fd:", 3) == 0) {
+        char *end;
+        long fd = strtol(spec + 3, &end, 10);
+        if (end != spec + 3 && *end == 0 && fd >= 0 && fd <= INT_MAX) {
+            stats_fd = fd;
+        } else {
+            fprintf(stderr, "Invalid stats file descriptor %s\n", spec);
+        }
+    }
+    stats.program = program;
+    // --stats may override the environment variable
+    if (stats.start == 0) {
+        stats.start = stats_now();
+    }
+}
+
+void stats_enable_from_environment(const char *program) {
+    const char *spec = getenv("WL_CLIPBOARD_STATS");
+    if (spec == NULL || spec[0] == 0) {
+        return;
+    }
+    static const char *const disabled[] = { "0", "no", "false", "off" };
+    for (size_t i = 0; i < sizeof(disabled) / sizeof(disabled[0]); i++) {
+        if (strcasecmp(spec, disabled[i]) == 0) {
+            return;
+        }
+    }
+    stats_enable(program, spec);
+}
+
+void stats_record_phase(const char *phase) {
+    if (stats.phase_count == MAX_PHASES) {
+        return;
+    }
+    stats.phases[stats.phase_count].name = phase;
+    stats.phases[stats.phase_count].time = stats_now();
+    stats.phase_count++;
+}
+
+void stats_record_transfer(const char *mime_type, off_t size, uint64_t start) {
+    if (stats.transfer_count == MAX_TRANSFERS) {
+        stats_report();
+    }
+    int i = stats.transfer_count++;
+    stats.transfers[i].mime_type = strdup(mime_type);
+    stats.transfers[i].size = size;
+    stats.transfers[i].start = start;
+    stats.transfers[i].end = stats_now();
+}
+
+// MIME types come from other clients, so they need escaping
+static void print_json_string(FILE *f, const char *string) {
+    fputc('"', f);
+    for (const unsigned char *ptr = (const unsigned char *) string; *ptr; ptr++) {
+        if (*ptr == '"' || *ptr == '\\') {
+            fprintf(f, "\\%c", *ptr);
+        } else if (*ptr < 0x20) {
+            fprintf(f, "\\u%04x", *ptr);
+        } else {
+            fputc(*ptr, f);
+        }
+    }
+    fputc('"', f);
+}
+
+void stats_report() {
+    if (stats_fd < 0) {
+        return;
+    }
+    // build the whole line in memory so that it
+    // gets written out with a single write()
+    char *line;
+    size_t line_size;
+    FILE *f = open_memstream(&line, &line_size);
+    if (f == NULL) {
+        return;
+    }
+
+    fprintf(f, "{\"program\":");
+    print_json_string(f, stats.program);
+    fprintf(f, ",\"pid\":%ld,\"phases\":{", (long) getpid());
+    for (int i = 0; i < stats.phase_count; i++) {
+        uint64_t offset = stats.phases[i].time - stats.start;
+        fprintf(
+            f,
+            "%s\"%s\":%" PRIu64,
+            i == 0 ? "" : ",",
+            stats.phases[i].name,
+            offset / 1000
+        );
+    }
+    fprintf(f, "},\"transfers\":[");
+    for (int i = 0; i < stats.transfer_count; i++) {
+        uint64_t duration = stats.transfers[i].end - stats.transfers[i].start;
+        double seconds = duration / 1e9;
+        double throughput = 0;
+        if (duration > 0) {
+            throughput = stats.transfers[i].size / seconds / 1e6;
+        }
+        fprintf(f, "%s{\"type\":", i == 0 ? "" : ",");
+        print_json_string(f, stats.transfers[i].mime_type);
+        fprintf(
+            f,
+            ",\"bytes\":%lld,\"start_us\":%" PRIu64
+            ",\"duration_us\":%" PRIu64 ",\"mb_per_s\":%.3f}",
+            (long long) stats.transfers[i].size,
+            (stats.transfers[i].start - stats.start) / 1000,
+            duration / 1000,
+            throughput
+        );
+        free(stats.transfers[i].mime_type);
+    }
+    stats.transfer_count = 0;
+    fprintf(f, "]}\n");
+    fclose(f);
+
+    for (size_t written = 0; written < line_size;) {
+        ssize_t res = write(stats_fd, line + written, line_size - written);
+        if (res <= 0) {
+            break;
+        }
+        written += res;
+    }
+    free(line);
+}
@@ -0,0 +1,59 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WL_CLIPBOARD_STATS_H
+#define WL_CLIPBOARD_STATS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// --stats support: timestamps of the phases an invocation goes
+// through and sizes of the transfers it makes, reported as JSON
+
+extern int stats_fd;
+
+// enables stats if requested by the spec, which is the argument
+// of --stats or the value of WL_CLIPBOARD_STATS: fd:N writes them
+// to file descriptor N, and anything else, including NULL, to stderr
+void stats_enable(const char *program, const char *spec);
+// same, but only if WL_CLIPBOARD_STATS is set
+void stats_enable_from_environment(const char *program);
+
+uint64_t stats_now(void);
+
+void stats_record_phase(const char *phase);
+void stats_record_transfer(const char *mime_type, off_t size, uint64_t start);
+// writes out a JSON line with everything recorded so far,
+// and forgets about the transfers it has reported
+void stats_report(void);
+
+// these are cheap enough to call when stats are disabled
+
+#define stats_phase(phase) do { \
+    if (stats_fd >= 0) { \
+        stats_record_phase(phase); \
+    } \
+} while (0)
+
+#define stats_transfer(mime_type, size, start) do { \
+    if (stats_fd >= 0) { \
+        stats_record_transfer(mime_type, size, start); \
+    } \
+} while (0)
+
+#endif
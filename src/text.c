@@ -0,0 +1,144 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "text.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define HIGH_BITS 0x8080808080808080ULL
+
+size_t ascii_prefix_length(const char *data, size_t size) {
+    size_t i = 0;
+    for (; i + 4 * sizeof(uint64_t) <= size; i += 4 * sizeof(uint64_t)) {
+        uint64_t words[4];
+        memcpy(words, data + i, sizeof(words));
+        if ((words[0] | words[1] | words[2] | words[3]) & HIGH_BITS) {
+            break;
+        }
+    }
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        if (word & HIGH_BITS) {
+            break;
+        }
+    }
+    while (i < size && (unsigned char) data[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+// returns the length of the UTF-8 sequence starting at the given
+// non-ASCII byte, or 0 if it's not a valid one
+static size_t sequence_length(const unsigned char *s, size_t size) {
+    unsigned char lower = 0x80, upper = 0xBF;
+    size_t length;
+    if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+        length = 2;
+    } else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+        length = 3;
+        if (s[0] == 0xE0) {
+            // overlong
+            lower = 0xA0;
+        } else if (s[0] == 0xED) {
+            // surrogates
+            upper = 0x9F;
+        }
+    } else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+        length = 4;
+        if (s[0] == 0xF0) {
+            // overlong
+            lower = 0x90;
+        } else if (s[0] == 0xF4) {
+            // past U+10FFFF
+            upper = 0x8F;
+        }
+    } else {
+        return 0;
+    }
+
+    if (size < length || s[1] < lower || s[1] > upper) {
+        return 0;
+    }
+    for (size_t i = 2; i < length; i++) {
+        if (s[i] < 0x80 || s[i] > 0xBF) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+int utf8_is_valid(const char *data, size_t size) {
+    const unsigned char *s = (const unsigned char *) data;
+    size_t i = 0;
+    while (i < size) {
+        i += ascii_prefix_length(data + i, size - i);
+        if (i == size) {
+            break;
+        }
+        size_t length = sequence_length(s + i, size - i);
+        if (length == 0) {
+            return 0;
+        }
+        i += length;
+    }
+    return 1;
+}
+
+size_t utf8_to_latin1(const char *in, size_t size, char *out) {
+    const unsigned char *s = (const unsigned char *) in;
+    size_t i = 0, o = 0;
+    while (i < size) {
+        size_t ascii = ascii_prefix_length(in + i, size - i);
+        memcpy(out + o, in + i, ascii);
+        i += ascii;
+        o += ascii;
+        if (i == size) {
+            break;
+        }
+        size_t length = sequence_length(s + i, size - i);
+        if (length == 2 && s[i] <= 0xC3) {
+            out[o++] = ((s[i] & 0x1F) << 6) | (s[i + 1] & 0x3F);
+        } else {
+            out[o++] = '?';
+        }
+        // skip over invalid bytes one at a time
+        i += length > 0 ? length : 1;
+    }
+    return o;
+}
+
+size_t latin1_to_utf8(const char *in, size_t size, char *out) {
+    const unsigned char *s = (const unsigned char *) in;
+    size_t i = 0, o = 0;
+    while (i < size) {
+        size_t ascii = ascii_prefix_length(in + i, size - i);
+        memcpy(out + o, in + i, ascii);
+        i += ascii;
+        o += ascii;
+        if (i == size) {
+            break;
+        }
+        out[o++] = 0xC0 | (s[i] >> 6);
+        out[o++] = 0x80 | (s[i] & 0x3F);
+        i++;
+    }
+    return o;
+}
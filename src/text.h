@@ -0,0 +1,40 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WL_CLIPBOARD_TEXT_H
+#define WL_CLIPBOARD_TEXT_H
+
+#include <stddef.h>
+
+// text encoding helpers; these skip over runs of ASCII a machine word
+// at a time, so typical text gets processed at close to memory speed
+
+// returns the length of the leading ASCII-only part of the data
+size_t ascii_prefix_length(const char *data, size_t size);
+
+int utf8_is_valid(const char *data, size_t size);
+
+// converts valid UTF-8 to ISO 8859-1, which is what the X11 STRING
+// target means, replacing the characters that don't fit with '?';
+// out must have room for size bytes, returns the converted size
+size_t utf8_to_latin1(const char *in, size_t size, char *out);
+
+// the other way around; out must have room for twice the size
+size_t latin1_to_utf8(const char *in, size_t size, char *out);
+
+#endif
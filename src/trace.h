@@ -0,0 +1,50 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WL_CLIPBOARD_TRACE_H
+#define WL_CLIPBOARD_TRACE_H
+
+// static tracepoints for perf, bpftrace and friends; a probe that
+// nothing is attached to compiles down to a single nop instruction
+//
+// usage: trace_probe(name, arg1[, arg2[, arg3]])
+
+#ifdef HAVE_SYS_SDT_H
+#    include <sys/sdt.h>
+
+#    define TRACE_PROBE_2(name, a) \
+         DTRACE_PROBE1(wl_clipboard, name, a)
+#    define TRACE_PROBE_3(name, a, b) \
+         DTRACE_PROBE2(wl_clipboard, name, a, b)
+#    define TRACE_PROBE_4(name, a, b, c) \
+         DTRACE_PROBE3(wl_clipboard, name, a, b, c)
+
+#    define TRACE_PICK(_1, _2, _3, _4, macro, ...) macro
+#    define trace_probe(...) \
+         TRACE_PICK( \
+             __VA_ARGS__, \
+             TRACE_PROBE_4, \
+             TRACE_PROBE_3, \
+             TRACE_PROBE_2, \
+             unused \
+         )(__VA_ARGS__)
+#else
+#    define trace_probe(...) do {} while (0)
+#endif
+
+#endif
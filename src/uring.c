@@ -0,0 +1,208 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE // SPLICE_F_MOVE
+
+#include "config.h"
+#include "uring.h"
+#include "loop.h"
+
+#include <errno.h>
+
+#ifdef HAVE_LIBURING
+
+#include <liburing.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+
+struct request {
+    void (*done)(void *data, int res);
+    void *data;
+};
+
+static struct io_uring ring;
+static int initialized = 0;
+static int available = 0;
+static int reaping = 0;
+static int unsubmitted = 0;
+
+static void submit() {
+    if (unsubmitted > 0 && io_uring_submit(&ring) >= 0) {
+        unsubmitted = 0;
+    }
+}
+
+static void reap_completions(void *data, int fd, uint32_t events) {
+    uint64_t count;
+    read(fd, &count, sizeof(count));
+
+    reaping = 1;
+    struct io_uring_cqe *cqe;
+    while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+        struct request *request = io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        request->done(request->data, res);
+        free(request);
+    }
+    reaping = 0;
+
+    // send off everything the handlers have queued at once
+    submit();
+}
+
+int uring_init() {
+    if (initialized) {
+        return available;
+    }
+    initialized = 1;
+
+    if (getenv("WL_CLIPBOARD_NO_URING") != NULL) {
+        return 0;
+    }
+    // this fails on kernels without io_uring support,
+    // and in sandboxes that don't allow using it
+    if (io_uring_queue_init(64, &ring, 0) < 0) {
+        return 0;
+    }
+    // don't leak the ring into converter commands and other children
+    fcntl(ring.ring_fd, F_SETFD, FD_CLOEXEC);
+    int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0 || io_uring_register_eventfd(&ring, event_fd) < 0) {
+        io_uring_queue_exit(&ring);
+        return 0;
+    }
+    loop_add_fd(event_fd, EPOLLIN, reap_completions, NULL);
+    available = 1;
+    return 1;
+}
+
+int uring_register_buffer(void *buffer, size_t size) {
+    struct iovec iov = {
+        .iov_base = buffer,
+        .iov_len = size
+    };
+    return io_uring_register_buffers(&ring, &iov, 1) == 0;
+}
+
+void uring_unregister_buffer() {
+    io_uring_unregister_buffers(&ring);
+}
+
+static struct io_uring_sqe *get_sqe(void (*done)(void *, int), void *data) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+    if (sqe == NULL) {
+        // the submission queue is full, make some room
+        submit();
+        sqe = io_uring_get_sqe(&ring);
+    }
+    if (sqe == NULL) {
+        return NULL;
+    }
+    struct request *request = malloc(sizeof(struct request));
+    request->done = done;
+    request->data = data;
+    io_uring_sqe_set_data(sqe, request);
+    return sqe;
+}
+
+static void queued() {
+    unsubmitted++;
+    if (!reaping) {
+        submit();
+    }
+}
+
+void uring_splice
+(
+    int file_fd,
+    off_t offset,
+    int to_fd,
+    size_t length,
+    void (*done)(void *data, int res),
+    void *data
+) {
+    struct io_uring_sqe *sqe = get_sqe(done, data);
+    if (sqe == NULL) {
+        done(data, -EBUSY);
+        return;
+    }
+    io_uring_prep_splice(
+        sqe, file_fd, offset, to_fd, -1, length, SPLICE_F_MOVE
+    );
+    queued();
+}
+
+void uring_write_fixed
+(
+    int to_fd,
+    const void *ptr,
+    size_t length,
+    void (*done)(void *data, int res),
+    void *data
+) {
+    struct io_uring_sqe *sqe = get_sqe(done, data);
+    if (sqe == NULL) {
+        done(data, -EBUSY);
+        return;
+    }
+    // an offset of -1 means the current position, which is
+    // the only thing that makes sense for pipes anyway
+    io_uring_prep_write_fixed(sqe, to_fd, ptr, length, -1, 0);
+    queued();
+}
+
+#else
+
+int uring_init() {
+    return 0;
+}
+
+int uring_register_buffer(void *buffer, size_t size) {
+    return 0;
+}
+
+void uring_unregister_buffer() {}
+
+void uring_splice
+(
+    int file_fd,
+    off_t offset,
+    int to_fd,
+    size_t length,
+    void (*done)(void *data, int res),
+    void *data
+) {
+    done(data, -ENOSYS);
+}
+
+void uring_write_fixed
+(
+    int to_fd,
+    const void *ptr,
+    size_t length,
+    void (*done)(void *data, int res),
+    void *data
+) {
+    done(data, -ENOSYS);
+}
+
+#endif
@@ -0,0 +1,58 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WL_CLIPBOARD_URING_H
+#define WL_CLIPBOARD_URING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// an optional io_uring backend for serving paste requests; it's only
+// used when built with liburing and allowed by the kernel at runtime,
+// otherwise callers stick to the plain syscall path
+//
+// completions are delivered through the event loop, and the requests
+// queued by the completion handlers get submitted in a single batch
+
+// returns whether the backend is available
+int uring_init(void);
+
+// registers a buffer to write from with uring_write_fixed();
+// only a single buffer is supported
+int uring_register_buffer(void *buffer, size_t size);
+// before freeing the buffer, make sure no writes from it are in flight
+void uring_unregister_buffer(void);
+
+// res is what the equivalent syscall would return, or -errno
+void uring_splice(
+    int file_fd,
+    off_t offset,
+    int to_fd,
+    size_t length,
+    void (*done)(void *data, int res),
+    void *data
+);
+void uring_write_fixed(
+    int to_fd,
+    const void *ptr,
+    size_t length,
+    void (*done)(void *data, int res),
+    void *data
+);
+
+#endif
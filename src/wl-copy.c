@@ -18,57 +18,1106 @@
 
 #include "boilerplate.h"
 
+#include <sys/socket.h>
+#include <sys/un.h> // sockaddr_un
+#include <time.h> // clock_gettime
+#include <stddef.h> // offsetof
+
+#ifdef __GLIBC__
+#    include <malloc.h> // malloc_trim
+#endif
+
 char * const *data_to_copy = NULL;
 char *temp_file_to_copy = NULL;
+const char *file_to_copy = NULL;
 int paste_once = 0;
+struct normalize_options normalize;
+// for --offer-meta
+int offer_meta = 0;
+uint64_t copied_at_ms;
+
+// state for --if-changed
+struct {
+    int enabled;
+    uint64_t payload_hash;
+    char *type_to_compare;
+    int type_offered;
+    void *offer;
+    void (*receive_f)(void *offer, const char *mime_type, int fd);
+} if_changed;
+
+// the selection being taken over with --from-selection
+struct {
+    int enabled;
+    int primary;
+    // the types to take, or all of them if none are given
+    char **wanted_types;
+    size_t wanted_count;
+    char **offered_types;
+    size_t offered_count;
+    int received;
+    void *offer;
+    void (*receive_f)(void *offer, const char *mime_type, int fd);
+    // how many of the types are still being received
+    size_t receiving;
+} from_selection;
+
+// the arguments joined with spaces, when copying those
+char *payload_buffer = NULL;
+size_t payload_buffer_size = 0;
+
+// the file copied with --file, or a snapshot of it
+int file_to_copy_fd = -1;
+int file_to_copy_is_snapshot = 0;
+// what the file looked like when it was copied
+struct stat file_to_copy_stat;
+
+// returns the file the payload is in, unless it's in payload_buffer;
+// the descriptor is shared, so it's only ever read at explicit offsets
+// and must not be closed
+int payload_file() {
+    // unless we've got a snapshot, make sure we don't
+    // serve something other than what has been copied
+    struct stat st;
+    if (!file_to_copy_is_snapshot && (
+        fstat(file_to_copy_fd, &st) < 0 ||
+        st.st_size != file_to_copy_stat.st_size ||
+        st.st_mtim.tv_sec != file_to_copy_stat.st_mtim.tv_sec ||
+        st.st_mtim.tv_nsec != file_to_copy_stat.st_mtim.tv_nsec
+    )) {
+        fprintf(stderr, "%s has changed since it was copied\n", file_to_copy);
+        return -1;
+    }
+    return file_to_copy_fd;
+}
+
+// a paste request that is being served
+struct transfer {
+    char *mime_type;
+    int fd;
+    // the temp file, or -1 when serving payload_buffer
+    int file_fd;
+    off_t offset;
+    off_t size;
+    uint64_t start;
+    struct loop_watch *watch;
+    // when waiting for a conversion to complete
+    struct transfer *next_waiting;
+};
+
+int transfers_in_flight = 0;
+int cancelled = 0;
+
+void remove_temp_file() {
+    if (temp_file_to_copy == NULL) {
+        return;
+    }
+    unlink(temp_file_to_copy);
+    rmdir(dirname(temp_file_to_copy));
+    temp_file_to_copy = NULL;
+}
 
 void do_cancel() {
+    cancelled = 1;
+    if (transfers_in_flight > 0) {
+        // let the pastes in progress complete first
+        return;
+    }
     // we're done!
-    if (temp_file_to_copy != NULL) {
-        execlp("rm", "rm", "-r", dirname(temp_file_to_copy), NULL);
-        perror("exec rm");
-        exit(1);
+    trace_probe(cancelled, temp_file_to_copy);
+    metrics_remove();
+    remove_temp_file();
+    exit(0);
+}
+
+void handle_termination(int signal_number) {
+    metrics_remove();
+    remove_temp_file();
+
+    // now die the way we were asked to
+    signal(signal_number, SIG_DFL);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, signal_number);
+    raise(signal_number);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    exit(1);
+}
+
+void finish_transfer(struct transfer *transfer, int succeeded) {
+    if (transfer->watch != NULL) {
+        loop_remove(transfer->watch);
+    }
+    close(transfer->fd);
+    if (transfer->file_fd >= 0) {
+        close(transfer->file_fd);
+    }
+
+    trace_probe(send_end, transfer->mime_type, transfer->fd, transfer->offset);
+    metrics_transfer_finished(
+        transfer->mime_type,
+        transfer->offset,
+        stats_now() - transfer->start,
+        succeeded
+    );
+
+    if (stats_fd >= 0) {
+        stats_transfer(transfer->mime_type, transfer->offset, transfer->start);
+        stats_report();
+    }
+
+    free(transfer->mime_type);
+    free(transfer);
+    transfers_in_flight--;
+
+    if (paste_once || cancelled) {
+        do_cancel();
+    }
+}
+
+void continue_transfer(void *data, int fd, uint32_t events) {
+    struct transfer *transfer = data;
+    // copy a bounded amount at a time, so that
+    // concurrent pastes all make progress
+    for (int i = 0; i < 16; i++) {
+        ssize_t res;
+        if (transfer->file_fd >= 0) {
+            res = send_file_chunk(
+                transfer->file_fd,
+                &transfer->offset,
+                fd
+            );
+        } else if (transfer->offset < transfer->size) {
+            res = write(
+                fd,
+                payload_buffer + transfer->offset,
+                transfer->size - transfer->offset
+            );
+            if (res > 0) {
+                transfer->offset += res;
+            }
+        } else {
+            res = 0;
+        }
+
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res < 0 && errno == EAGAIN) {
+            // wait for the reader to catch up
+            return;
+        }
+        if (res < 0 && errno != EPIPE) {
+            perror("write");
+        }
+        if (res <= 0) {
+            finish_transfer(transfer, transfer->offset == transfer->size);
+            return;
+        }
+    }
+}
+
+void uring_chunk_done(void *data, int res);
+
+void submit_uring_chunk(struct transfer *transfer) {
+    size_t length = 1024 * 1024;
+    if ((off_t) length > transfer->size - transfer->offset) {
+        length = transfer->size - transfer->offset;
+    }
+    if (length == 0) {
+        finish_transfer(transfer, 1);
+    } else if (transfer->file_fd >= 0) {
+        uring_splice(
+            transfer->file_fd,
+            transfer->offset,
+            transfer->fd,
+            length,
+            uring_chunk_done,
+            transfer
+        );
     } else {
-        exit(0);
+        uring_write_fixed(
+            transfer->fd,
+            payload_buffer + transfer->offset,
+            length,
+            uring_chunk_done,
+            transfer
+        );
     }
 }
 
-void do_send(const char *mime_type, int fd) {
-    // unset O_NONBLOCK
-    fcntl(fd, F_SETFL, 0);
+void uring_chunk_done(void *data, int res) {
+    struct transfer *transfer = data;
+    // if the other end is not a pipe, it can't be spliced into, the
+    // kernel may refuse a fixed buffer write, and if the ring is full,
+    // the request never got queued; either way, leave this transfer
+    // to the plain syscall path, where send_file_chunk() knows to
+    // copy through a buffer
+    if (res == -EBUSY || res == -EINVAL) {
+        fcntl(transfer->fd, F_SETFL, O_NONBLOCK);
+        transfer->watch = loop_add_fd(
+            transfer->fd,
+            EPOLLOUT,
+            continue_transfer,
+            transfer
+        );
+        return;
+    }
+    if (res < 0 && res != -EPIPE) {
+        errno = -res;
+        perror("write");
+    }
+    if (res <= 0) {
+        finish_transfer(transfer, transfer->offset == transfer->size);
+        return;
+    }
+    transfer->offset += res;
+    submit_uring_chunk(transfer);
+}
+
+// whether io_uring writes straight from payload_buffer
+int payload_buffer_registered = -1;
+
+int can_use_uring(struct transfer *transfer) {
+    if (!uring_init()) {
+        return 0;
+    }
+    if (transfer->file_fd >= 0) {
+        return 1;
+    }
+    if (payload_buffer_registered < 0) {
+        payload_buffer_registered = uring_register_buffer(
+            payload_buffer,
+            payload_buffer_size
+        );
+    }
+    return payload_buffer_registered;
+}
+
+// the type the payload itself is offered as
+char *content_type = NULL;
+struct converter *converters = NULL;
+
+// the payload converted to other types; these are produced
+// on the first paste request for them and reused after that
+enum representation_state {
+    REPRESENTATION_CONVERTING,
+    REPRESENTATION_READY,
+    // the converter has found nothing to convert
+    REPRESENTATION_AS_IS,
+    REPRESENTATION_FAILED
+};
+
+struct representation {
+    char *mime_type;
+    enum representation_state state;
+    // an anonymous file with the converted data
+    int fd;
+    // the converter command, while it runs
+    pid_t pid;
+    // the transfers waiting for the conversion to complete
+    struct transfer *waiting;
+    struct representation *next;
+};
+
+struct representation *representations = NULL;
+
+// makes the given file get served for the type, without any conversion
+void add_representation(const char *mime_type, int fd) {
+    struct representation *r = calloc(1, sizeof(struct representation));
+    r->mime_type = strdup(mime_type);
+    r->state = REPRESENTATION_READY;
+    r->fd = fd;
+    r->next = representations;
+    representations = r;
+}
+
+// maps the whole payload into memory, returns NULL if it's empty
+const char *map_payload(size_t *size) {
     if (data_to_copy != NULL) {
-        // copy the specified data, separated by spaces
-        FILE *f = fdopen(fd, "w");
-        if (f == NULL) {
-            perror("fdopen");
-            exit(1);
+        *size = payload_buffer_size;
+        return payload_buffer;
+    }
+    int fd = payload_file();
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+        return NULL;
+    }
+    *size = st.st_size;
+    void *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    return data != MAP_FAILED ? data : NULL;
+}
+
+void unmap_payload(const char *data, size_t size) {
+    if (data != NULL && data != payload_buffer) {
+        munmap((void *) data, size);
+    }
+}
+
+int convert_payload_to_latin1() {
+    size_t size;
+    const char *data = map_payload(&size);
+    if (data == NULL) {
+        return -1;
+    }
+    // plain ASCII is the same in Latin-1, and data that isn't valid
+    // UTF-8 is probably in some other encoding already; serve both as is
+    if (
+        ascii_prefix_length(data, size) == size ||
+        !utf8_is_valid(data, size)
+    ) {
+        unmap_payload(data, size);
+        return -1;
+    }
+
+    // the result is never longer than the original,
+    // so convert right into the file and shrink it afterwards
+    int fd = create_anonymous_file();
+    char *out = MAP_FAILED;
+    if (fd >= 0 && ftruncate(fd, size) == 0) {
+        out = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (out == MAP_FAILED) {
+        perror("mmap");
+        if (fd >= 0) {
+            close(fd);
         }
-        char * const *dataptr = data_to_copy;
-        for (int is_first = 1; *dataptr != NULL; dataptr++, is_first = 0) {
-            if (!is_first) {
-                fwrite(" ", 1, 1, f);
+        unmap_payload(data, size);
+        return -1;
+    }
+    size_t converted_size = utf8_to_latin1(data, size, out);
+    munmap(out, size);
+    ftruncate(fd, converted_size);
+    unmap_payload(data, size);
+    return fd;
+}
+
+// feeds the file into a pipe from a child process, which reads it
+// at explicit offsets like everyone else; returns the read end
+int pipe_payload_file() {
+    int fd = payload_file();
+    int pipefd[2];
+    if (fd < 0 || pipe(pipefd) < 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        // there may be worker threads in the parent, so only
+        // async-signal-safe calls from here on
+        close(pipefd[0]);
+        char buffer[64 * 1024];
+        off_t offset = 0;
+        ssize_t res;
+        while ((res = pread(fd, buffer, sizeof(buffer), offset)) > 0) {
+            for (ssize_t written = 0; written < res;) {
+                ssize_t w = write(pipefd[1], buffer + written, res - written);
+                if (w < 0 && errno != EINTR) {
+                    _exit(1);
+                }
+                written += w > 0 ? w : 0;
             }
-            fwrite(*dataptr, 1, strlen(*dataptr), f);
+            offset += res;
         }
-        fclose(f);
+        _exit(res < 0);
+    }
+    close(pipefd[1]);
+    if (pid < 0) {
+        perror("fork");
+        close(pipefd[0]);
+        return -1;
+    }
+    // reap_converters() takes care of it once it's done
+    return pipefd[0];
+}
+
+// writes payload_buffer out into the file, which is closed on failure
+int write_payload_buffer(int fd) {
+    if (fd < 0) {
+        return -1;
+    }
+    for (size_t written = 0; written < payload_buffer_size;) {
+        ssize_t res = write(
+            fd,
+            payload_buffer + written,
+            payload_buffer_size - written
+        );
+        if (res < 0) {
+            close(fd);
+            return -1;
+        }
+        written += res;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+// returns a file to feed the payload to a converter command from
+int payload_input_fd() {
+    if (data_to_copy == NULL) {
+        return pipe_payload_file();
+    }
+    return write_payload_buffer(create_anonymous_file());
+}
+
+void run_converter_command
+(
+    struct representation *representation,
+    const char *command
+) {
+    int input_fd = payload_input_fd();
+    representation->fd = create_anonymous_file();
+    if (input_fd < 0 || representation->fd < 0) {
+        representation->state = REPRESENTATION_FAILED;
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // there may be worker threads in the parent, holding
+        // locks in stdio or malloc, so only async-signal-safe
+        // calls from here on
+        dup2(input_fd, STDIN_FILENO);
+        dup2(representation->fd, STDOUT_FILENO);
+        // undo what we've set up for ourselves
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        signal(SIGPIPE, SIG_DFL);
+        char *const args[] = { "sh", "-c", (char *) command, NULL };
+        execve("/bin/sh", args, environ);
+        static const char message[] = "Failed to run /bin/sh\n";
+        write(STDERR_FILENO, message, sizeof(message) - 1);
+        _exit(1);
+    }
+    close(input_fd);
+    if (pid < 0) {
+        perror("fork");
+        representation->state = REPRESENTATION_FAILED;
+        return;
+    }
+    // we'll get SIGCHLD once it's done
+    representation->pid = pid;
+    representation->state = REPRESENTATION_CONVERTING;
+}
+
+off_t payload_size() {
+    off_t size = 0;
+    if (data_to_copy != NULL) {
+        size = payload_buffer_size;
+    } else if (file_to_copy_fd >= 0) {
+        size = file_to_copy_stat.st_size;
+    }
+    return size;
+}
+
+// returns 0 if the payload can't be read
+int compute_payload_hash(uint64_t *hash) {
+    struct hash_state state;
+    hash_init(&state);
+    if (data_to_copy != NULL) {
+        hash_update(&state, payload_buffer, payload_buffer_size);
     } else {
-        // copy from the temp file; for that, we delegate to a
-        // (hopefully) highly optimized implementation of copying
-        if (fork() == 0) {
-            dup2(fd, STDOUT_FILENO);
-            execlp("cat", "cat", temp_file_to_copy, NULL);
-            perror("exec cat");
+        // this runs on the workers, so don't touch the file offset
+        int fd = payload_file();
+        if (fd < 0) {
+            return 0;
+        }
+        char buffer[64 * 1024];
+        off_t offset = 0;
+        ssize_t res;
+        while ((res = pread(fd, buffer, sizeof(buffer), offset)) > 0) {
+            hash_update(&state, buffer, res);
+            offset += res;
+        }
+        if (res < 0) {
+            perror("read");
+            return 0;
+        }
+    }
+    *hash = hash_digest(&state);
+    return 1;
+}
+
+// whether pasting the type gets the payload itself, without conversion
+int type_is_served_as_is(const char *mime_type) {
+    for (struct representation *r = representations; r; r = r->next) {
+        if (strcmp(r->mime_type, mime_type) == 0) {
+            return 0;
+        }
+    }
+    if (strcmp(mime_type, content_type) == 0) {
+        return 1;
+    }
+    for (struct converter *c = converters; c != NULL; c = c->next) {
+        if (
+            strcmp(c->target_type, mime_type) == 0 &&
+            converter_accepts(c, content_type)
+        ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void start_transfer
+(
+    struct transfer *transfer,
+    struct representation *representation
+) {
+    enum representation_state state = REPRESENTATION_AS_IS;
+    if (representation != NULL) {
+        state = representation->state;
+    }
+
+    if (state == REPRESENTATION_FAILED) {
+        transfer->size = -1;
+    } else if (state == REPRESENTATION_AS_IS && data_to_copy != NULL) {
+        transfer->size = payload_buffer_size;
+    } else {
+        // transfers read at their own offsets, so they
+        // can share the converted file or the payload file
+        int file_fd;
+        if (state == REPRESENTATION_READY) {
+            file_fd = representation->fd;
+        } else {
+            file_fd = payload_file();
+        }
+        transfer->file_fd = file_fd >= 0 ? dup(file_fd) : -1;
+        struct stat st;
+        if (transfer->file_fd < 0 || fstat(transfer->file_fd, &st) < 0) {
+            transfer->size = -1;
+        } else {
+            transfer->size = st.st_size;
+        }
+    }
+
+    if (transfer->size < 0) {
+        finish_transfer(transfer, 0);
+    } else if (can_use_uring(transfer)) {
+        // io_uring waits for the pipe to become writable by itself
+        fcntl(transfer->fd, F_SETFL, 0);
+        submit_uring_chunk(transfer);
+    } else {
+        transfer->watch = loop_add_fd(
+            transfer->fd,
+            EPOLLOUT,
+            continue_transfer,
+            transfer
+        );
+    }
+}
+
+// resumes the transfers that have been waiting for the representation
+void representation_done(struct representation *r) {
+    while (r->waiting != NULL) {
+        struct transfer *transfer = r->waiting;
+        r->waiting = transfer->next_waiting;
+        start_transfer(transfer, r);
+    }
+}
+
+// hashing the payload for --offer-meta takes a while for large
+// content, so it happens on a worker thread
+struct meta_job {
+    struct representation *representation;
+    struct clipboard_meta meta;
+    int hashed;
+    int fd;
+};
+
+void write_meta_file(void *data) {
+    struct meta_job *job = data;
+    job->fd = -1;
+    if (!job->hashed && !compute_payload_hash(&job->meta.hash)) {
+        return;
+    }
+    char buffer[CLIPBOARD_META_MAX_SIZE];
+    ssize_t length = format_clipboard_meta(&job->meta, buffer, sizeof(buffer));
+    int fd = create_anonymous_file();
+    if (length < 0 || fd < 0 || write(fd, buffer, length) != length) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    job->fd = fd;
+}
+
+void meta_file_written(void *data) {
+    struct meta_job *job = data;
+    struct representation *r = job->representation;
+    r->fd = job->fd;
+    r->state = r->fd >= 0 ? REPRESENTATION_READY : REPRESENTATION_FAILED;
+    free(job);
+    representation_done(r);
+}
+
+// describes the payload for --offer-meta, see meta.h
+struct representation *describe_payload() {
+    struct representation *r = calloc(1, sizeof(struct representation));
+    r->mime_type = strdup(clipboard_meta_type);
+    r->state = REPRESENTATION_CONVERTING;
+    r->next = representations;
+    representations = r;
+
+    const char *candidates[] = {
+        content_type, text_plain, text_plain_utf8,
+        "TEXT", "STRING", "UTF8_STRING"
+    };
+    // the generic text types are only offered for text
+    size_t candidate_count = mime_type_is_text(content_type) ? 6 : 1;
+    const char *types[6];
+    size_t count = 0;
+    for (size_t i = 0; i < candidate_count; i++) {
+        if (i > 0 && strcmp(candidates[i], content_type) == 0) {
+            continue;
+        }
+        if (type_is_served_as_is(candidates[i])) {
+            types[count++] = candidates[i];
+        }
+    }
+
+    struct meta_job *job = calloc(1, sizeof(struct meta_job));
+    job->representation = r;
+    if (!set_clipboard_meta_types(&job->meta, types, count)) {
+        free(job);
+        r->state = REPRESENTATION_FAILED;
+        return r;
+    }
+    job->meta.size = payload_size();
+    job->meta.time_ms = copied_at_ms;
+    if (if_changed.enabled) {
+        // already hashed it
+        job->meta.hash = if_changed.payload_hash;
+        job->hashed = 1;
+    }
+    workers_submit(write_meta_file, meta_file_written, job);
+    return r;
+}
+
+void convert_to_latin1(void *data) {
+    struct representation *r = data;
+    r->fd = convert_payload_to_latin1();
+}
+
+void converted_to_latin1(void *data) {
+    struct representation *r = data;
+    r->state = r->fd >= 0 ? REPRESENTATION_READY : REPRESENTATION_AS_IS;
+    representation_done(r);
+}
+
+// returns the representation to send for the given type,
+// or NULL if the payload itself should be sent
+struct representation *representation_for_type(const char *mime_type) {
+    for (struct representation *r = representations; r; r = r->next) {
+        if (strcmp(r->mime_type, mime_type) == 0) {
+            return r;
+        }
+    }
+    if (offer_meta && strcmp(mime_type, clipboard_meta_type) == 0) {
+        // only describe the payload once somebody asks
+        return describe_payload();
+    }
+    if (strcmp(mime_type, content_type) == 0) {
+        return NULL;
+    }
+    struct converter *converter = converters;
+    for (; converter != NULL; converter = converter->next) {
+        if (
+            strcmp(converter->target_type, mime_type) == 0 &&
+            converter_accepts(converter, content_type)
+        ) {
+            break;
+        }
+    }
+    if (converter == NULL) {
+        return NULL;
+    }
+
+    struct representation *r = calloc(1, sizeof(struct representation));
+    r->mime_type = strdup(mime_type);
+    r->next = representations;
+    representations = r;
+    switch (converter->kind) {
+    case CONVERTER_LATIN1:
+        r->state = REPRESENTATION_CONVERTING;
+        workers_submit(convert_to_latin1, converted_to_latin1, r);
+        break;
+    case CONVERTER_COMMAND:
+        run_converter_command(r, converter->command);
+        break;
+    }
+    return r;
+}
+
+void reap_converters(int signal_number) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        struct representation *r = representations;
+        while (r != NULL && r->pid != pid) {
+            r = r->next;
+        }
+        if (r == NULL) {
+            continue;
+        }
+        r->pid = 0;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            r->state = REPRESENTATION_READY;
+        } else {
+            fprintf(stderr, "Failed to convert content to %s\n", r->mime_type);
+            r->state = REPRESENTATION_FAILED;
+        }
+        representation_done(r);
+    }
+}
+
+void do_send(const char *mime_type, int fd) {
+    struct transfer *transfer = calloc(1, sizeof(struct transfer));
+    transfer->mime_type = strdup(mime_type);
+    transfer->fd = fd;
+    transfer->file_fd = -1;
+    transfer->start = stats_now();
+    trace_probe(send_start, mime_type, fd);
+    metrics_transfer_started();
+    transfers_in_flight++;
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    struct representation *representation = representation_for_type(
+        mime_type
+    );
+    if (
+        representation != NULL &&
+        representation->state == REPRESENTATION_CONVERTING
+    ) {
+        transfer->next_waiting = representation->waiting;
+        representation->waiting = transfer;
+        return;
+    }
+    start_transfer(transfer, representation);
+}
+
+int append_to_payload_buffer(void *data, const char *buffer, size_t size) {
+    payload_buffer = realloc(payload_buffer, payload_buffer_size + size);
+    memcpy(payload_buffer + payload_buffer_size, buffer, size);
+    payload_buffer_size += size;
+    return 1;
+}
+
+void append_file_uri(const char *path) {
+    static const char hex[] = "0123456789ABCDEF";
+    append_to_payload_buffer(NULL, "file://", 7);
+    for (const unsigned char *c = (const unsigned char *) path; *c; c++) {
+        if (isalnum(*c) || strchr("/-._~", *c) != NULL) {
+            append_to_payload_buffer(NULL, (const char *) c, 1);
+        } else {
+            char escaped[3] = { '%', hex[*c >> 4], hex[*c & 0xF] };
+            append_to_payload_buffer(NULL, escaped, 3);
+        }
+    }
+}
+
+// sets up copying the files themselves rather than their content: the
+// payload is their text/uri-list, and the content of a single regular
+// file is only served straight from it if somebody asks for its type
+void copy_file_references() {
+    char **paths = NULL;
+    size_t count = 0;
+    for (char * const *dataptr = data_to_copy; *dataptr; dataptr++) {
+        char *path = realpath(*dataptr, NULL);
+        if (path == NULL) {
+            perror(*dataptr);
             exit(1);
         }
+        paths = realloc(paths, (count + 1) * sizeof(char *));
+        paths[count++] = path;
+    }
+
+    // the file manager flavor is a list of the same URIs
+    append_to_payload_buffer(NULL, "copy", 4);
+    for (size_t i = 0; i < count; i++) {
+        append_to_payload_buffer(NULL, "\n", 1);
+        append_file_uri(paths[i]);
+    }
+    // it's just an extra, so leave it out if it can't be stored
+    int fd = create_anonymous_file();
+    ssize_t size = payload_buffer_size;
+    if (fd >= 0 && write(fd, payload_buffer, size) == size) {
+        add_representation("x-special/gnome-copied-files", fd);
+    } else if (fd >= 0) {
         close(fd);
-        wait(NULL);
     }
 
-    if (paste_once) {
-        do_cancel();
+    free(payload_buffer);
+    payload_buffer = NULL;
+    payload_buffer_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        append_file_uri(paths[i]);
+        append_to_payload_buffer(NULL, "\r\n", 2);
+    }
+
+    struct stat st;
+    if (count == 1 && stat(paths[0], &st) == 0 && S_ISREG(st.st_mode)) {
+        // plain text is what the URIs themselves are offered as
+        char *file_type = infer_mime_type_from_contents(paths[0]);
+        if (file_type != NULL && !str_has_prefix(file_type, text_plain)) {
+            int file_fd = open(paths[0], O_RDONLY);
+            if (file_fd >= 0) {
+                add_representation(file_type, file_fd);
+            }
+        }
+        free(file_type);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+void join_data_to_copy() {
+    for (char * const *dataptr = data_to_copy; *dataptr != NULL; dataptr++) {
+        payload_buffer_size += strlen(*dataptr) + 1;
+    }
+    payload_buffer = malloc(payload_buffer_size);
+    char *ptr = payload_buffer;
+    char * const *dataptr = data_to_copy;
+    for (int is_first = 1; *dataptr != NULL; dataptr++, is_first = 0) {
+        if (!is_first) {
+            *ptr++ = ' ';
+        }
+        size_t length = strlen(*dataptr);
+        memcpy(ptr, *dataptr, length);
+        ptr += length;
+    }
+    payload_buffer_size = ptr - payload_buffer;
+
+    if (normalize_options_active(&normalize)) {
+        char *joined = payload_buffer;
+        size_t joined_size = payload_buffer_size;
+        payload_buffer = malloc(1);
+        payload_buffer_size = 0;
+        struct normalizer *normalizer = normalizer_create(
+            &normalize,
+            append_to_payload_buffer,
+            NULL
+        );
+        normalizer_feed(normalizer, joined, joined_size);
+        normalizer_finish(normalizer);
+        free(joined);
     }
 }
 
+void hash_payload() {
+    if (!compute_payload_hash(&if_changed.payload_hash)) {
+        exit(1);
+    }
+}
+
+void remember_offered_type(const char *mime_type) {
+    if (strcmp(mime_type, if_changed.type_to_compare) == 0) {
+        if_changed.type_offered = 1;
+    }
+}
+
+void remember_selection
+(
+    void *offer,
+    void (*receive_f)(void *offer, const char *mime_type, int fd)
+) {
+    if_changed.offer = offer;
+    if_changed.receive_f = receive_f;
+}
+
+// how long the owner of the current selection gets to send it
+#define IF_CHANGED_TIMEOUT_NS (1000 * 1000 * 1000ull)
+
+// whether the current selection already has the same content
+// that we're about to copy, in which case we shouldn't bother
+int selection_is_unchanged() {
+    // make sure we've received the current selection
+    wl_display_roundtrip(display);
+    if (if_changed.offer == NULL || !if_changed.type_offered) {
+        return 0;
+    }
+
+    int pipefd[2];
+    if (pipe(pipefd) < 0) {
+        perror("pipe");
+        return 0;
+    }
+    if_changed.receive_f(
+        if_changed.offer,
+        if_changed.type_to_compare,
+        pipefd[1]
+    );
+    wl_display_flush(display);
+    close(pipefd[1]);
+
+    // a slow or stuck owner must not hold us up, and content that
+    // is longer than ours can't be the same, so stop reading then;
+    // anything short of reading all of it counts as a change
+    off_t expected_size = payload_size();
+    uint64_t deadline = stats_now() + IF_CHANGED_TIMEOUT_NS;
+    struct hash_state state;
+    hash_init(&state);
+    char buffer[64 * 1024];
+    off_t size = 0;
+    int complete = 0;
+    while (size <= expected_size) {
+        uint64_t now = stats_now();
+        if (now >= deadline) {
+            break;
+        }
+        struct pollfd pollfd = { .fd = pipefd[0], .events = POLLIN };
+        int res = poll(&pollfd, 1, (deadline - now) / 1000000 + 1);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            break;
+        }
+        ssize_t got = read(pipefd[0], buffer, sizeof(buffer));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            complete = got == 0;
+            break;
+        }
+        hash_update(&state, buffer, got);
+        size += got;
+    }
+    close(pipefd[0]);
+    return complete && size == expected_size &&
+        hash_digest(&state) == if_changed.payload_hash;
+}
+
+// payloads smaller than this aren't worth moving out of the heap
+#define SPILL_THRESHOLD (64 * 1024)
+#define SPILL_DELAY_NS (10 * 1000 * 1000 * 1000ull)
+
+struct loop_watch *spill_timer = NULL;
+
+// once nobody has pasted for a while, moves the payload from our memory
+// into a file on disk, which then gets served the same way as --file
+void spill_payload(void *data) {
+    // workers might be reading the payload buffer too
+    if (transfers_in_flight > 0 || workers_pending() > 0) {
+        loop_arm_timer(spill_timer, SPILL_DELAY_NS);
+        return;
+    }
+    loop_remove(spill_timer);
+    spill_timer = NULL;
+
+    // an anonymous file would stay in memory all the same
+    int fd = write_payload_buffer(create_disk_backed_file());
+    if (fd < 0) {
+        return;
+    }
+    file_to_copy_fd = fd;
+    file_to_copy_is_snapshot = 1;
+    fstat(fd, &file_to_copy_stat);
+    data_to_copy = NULL;
+    if (payload_buffer_registered > 0) {
+        uring_unregister_buffer();
+    }
+    free(payload_buffer);
+    payload_buffer = NULL;
+    payload_buffer_size = 0;
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
+// once the selection is set, all that's left to do is
+// serving paste requests, so let go of everything else
+void shed_resources() {
+    release_focus_objects();
+    if (data_to_copy != NULL && payload_buffer_size >= SPILL_THRESHOLD) {
+        spill_timer = loop_add_timer(spill_payload, NULL);
+        loop_arm_timer(spill_timer, SPILL_DELAY_NS);
+    }
+}
+
+// the parent process waiting for us to set the selection, and --ready-fd
+int ready_pipe_fd = -1;
+int ready_fd = -1;
+
+void set_ready_fd(const char *spec) {
+    char *end;
+    long fd = strtol(spec, &end, 10);
+    if (end == spec || *end != 0 || fd < 0 || fcntl(fd, F_GETFD) < 0) {
+        bail("--ready-fd requires an open file descriptor");
+    }
+    // not to be inherited by converter commands
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    ready_fd = fd;
+}
+
+// tells the service manager, like sd_notify(3) does
+void notify_service_manager() {
+    const char *path = getenv("NOTIFY_SOCKET");
+    if (path == NULL || (path[0] != '/' && path[0] != '@')) {
+        return;
+    }
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    size_t length = strlen(path);
+    if (length >= sizeof(address.sun_path)) {
+        return;
+    }
+    memcpy(address.sun_path, path, length);
+    if (address.sun_path[0] == '@') {
+        // an abstract socket
+        address.sun_path[0] = 0;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return;
+    }
+    char message[64];
+    snprintf(message, sizeof(message), "READY=1\nMAINPID=%d", (int) getpid());
+    sendto(
+        fd,
+        message,
+        strlen(message),
+        0,
+        (struct sockaddr *) &address,
+        offsetof(struct sockaddr_un, sun_path) + length
+    );
+    close(fd);
+    // the converter commands we run are not the service
+    unsetenv("NOTIFY_SOCKET");
+}
+
+// lets everyone interested know that the selection is now ours, so
+// that whatever comes next already sees the new content when pasting
+void notify_ready() {
+    if (ready_pipe_fd >= 0) {
+        write(ready_pipe_fd, "", 1);
+        close(ready_pipe_fd);
+        ready_pipe_fd = -1;
+    }
+    if (ready_fd >= 0) {
+        write(ready_fd, "\n", 1);
+        close(ready_fd);
+        ready_fd = -1;
+    }
+    notify_service_manager();
+}
+
+void report_selection_set() {
+    off_t size = payload_size();
+    trace_probe(selection_set, size);
+    stats_phase("selection");
+    stats_report();
+    metrics_set_payload_size(size);
+    metrics_write();
+    notify_ready();
+    shed_resources();
+}
+
 void data_source_target_handler
 (
     void *data,
@@ -103,8 +1152,12 @@ const struct wl_data_source_listener data_source_listener = {
 struct wl_data_source *data_source;
 
 void set_data_selection(uint32_t serial) {
+    if (if_changed.enabled && selection_is_unchanged()) {
+        do_cancel();
+    }
     wl_data_device_set_selection(data_device, data_source, serial);
     wl_display_roundtrip(display);
+    report_selection_set();
     destroy_popup_surface();
 }
 
@@ -146,6 +1199,9 @@ gtk_primary_selection_source_listener = {
 struct gtk_primary_selection_source *gtk_primary_selection_source;
 
 void set_gtk_primary_selection(uint32_t serial) {
+    if (if_changed.enabled && selection_is_unchanged()) {
+        do_cancel();
+    }
 
     gtk_primary_selection_device_set_selection(
         gtk_primary_selection_device,
@@ -154,6 +1210,7 @@ void set_gtk_primary_selection(uint32_t serial) {
     );
 
     wl_display_roundtrip(display);
+    report_selection_set();
     destroy_popup_surface();
 }
 
@@ -188,6 +1245,9 @@ primary_selection_source_listener = {
 struct zwp_primary_selection_source_v1 *primary_selection_source;
 
 void set_primary_selection(uint32_t serial) {
+    if (if_changed.enabled && selection_is_unchanged()) {
+        do_cancel();
+    }
 
     zwp_primary_selection_device_v1_set_selection(
         primary_selection_device,
@@ -196,6 +1256,7 @@ void set_primary_selection(uint32_t serial) {
     );
 
     wl_display_roundtrip(display);
+    report_selection_set();
     destroy_popup_surface();
 }
 
@@ -228,6 +1289,31 @@ data_control_source_listener = {
 };
 #endif
 
+// the types offered so far, so that none gets offered twice
+struct {
+    const char **types;
+    size_t count;
+} offered;
+
+void offer_once
+(
+    const char *mime_type,
+    void *source,
+    void (*offer_f)(void *source, const char *type)
+) {
+    for (size_t i = 0; i < offered.count; i++) {
+        if (strcmp(offered.types[i], mime_type) == 0) {
+            return;
+        }
+    }
+    offered.types = realloc(
+        offered.types,
+        (offered.count + 1) * sizeof(char *)
+    );
+    offered.types[offered.count++] = mime_type;
+    offer_f(source, mime_type);
+}
+
 void do_offer
 (
     char *mime_type,
@@ -236,14 +1322,31 @@ void do_offer
 ) {
     if (mime_type == NULL || mime_type_is_text(mime_type)) {
         // offer a few generic plain text formats
-        offer_f(source, text_plain);
-        offer_f(source, text_plain_utf8);
-        offer_f(source, "TEXT");
-        offer_f(source, "STRING");
-        offer_f(source, "UTF8_STRING");
+        offer_once(text_plain, source, offer_f);
+        offer_once(text_plain_utf8, source, offer_f);
+        offer_once("TEXT", source, offer_f);
+        offer_once("STRING", source, offer_f);
+        offer_once("UTF8_STRING", source, offer_f);
     }
     if (mime_type != NULL) {
-        offer_f(source, mime_type);
+        offer_once(content_type, source, offer_f);
+    }
+    // with --clear, there's no content to describe
+    if (offer_meta && content_type != NULL) {
+        offer_once(clipboard_meta_type, source, offer_f);
+    }
+
+    // and the types we've got the content ready in
+    for (struct representation *r = representations; r; r = r->next) {
+        offer_once(r->mime_type, source, offer_f);
+    }
+
+    // also offer the types we can convert the content to; we
+    // only run the conversion when somebody asks for the result
+    for (struct converter *c = converters; c != NULL; c = c->next) {
+        if (converter_accepts(c, content_type)) {
+            offer_once(c->target_type, source, offer_f);
+        }
     }
     free(mime_type);
 }
@@ -251,6 +1354,8 @@ void do_offer
 void init_selection(char *mime_type) {
     if (use_wlr_data_control) {
 #ifdef HAVE_WLR_DATA_CONTROL
+        // in case --primary-source has popped it up
+        destroy_popup_surface();
         struct zwlr_data_control_source_v1 *data_control_source =
             zwlr_data_control_manager_v1_create_data_source(
                 data_control_manager
@@ -267,10 +1372,15 @@ void init_selection(char *mime_type) {
             (void (*)(void *, const char *)) zwlr_data_control_source_v1_offer
         );
 
+        if (if_changed.enabled && selection_is_unchanged()) {
+            do_cancel();
+        }
         zwlr_data_control_device_v1_set_selection(
             data_control_device,
             data_control_source
         );
+        wl_display_roundtrip(display);
+        report_selection_set();
 #endif
     } else {
         data_source = wl_data_device_manager_create_data_source(
@@ -345,33 +1455,423 @@ void init_primary_selection(char *mime_type) {
 #endif
 }
 
+void remember_source_type(const char *mime_type) {
+    from_selection.offered_types = realloc(
+        from_selection.offered_types,
+        (from_selection.offered_count + 1) * sizeof(char *)
+    );
+    from_selection.offered_types[from_selection.offered_count++] =
+        strdup(mime_type);
+}
+
+void remember_source_selection
+(
+    void *offer,
+    void (*receive_f)(void *offer, const char *mime_type, int fd)
+) {
+    from_selection.offer = offer;
+    from_selection.receive_f = receive_f;
+    from_selection.received = 1;
+}
+
+int source_type_is_wanted(size_t index) {
+    const char *mime_type = from_selection.offered_types[index];
+    // some sources offer the same type more than once
+    for (size_t i = 0; i < index; i++) {
+        if (strcmp(from_selection.offered_types[i], mime_type) == 0) {
+            return 0;
+        }
+    }
+    if (from_selection.wanted_count == 0) {
+        return 1;
+    }
+    for (size_t i = 0; i < from_selection.wanted_count; i++) {
+        if (strcmp(from_selection.wanted_types[i], mime_type) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// one of the types take_selection() is receiving
+struct source_transfer {
+    const char *mime_type;
+    int pipe_fd;
+    int file_fd;
+    struct loop_watch *watch;
+};
+
+void continue_taking(void *data, int fd, uint32_t events) {
+    struct source_transfer *transfer = data;
+    char buffer[64 * 1024];
+    ssize_t res = read(fd, buffer, sizeof(buffer));
+    if (res < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
+    if (res < 0) {
+        fprintf(stderr, "Failed to receive %s\n", transfer->mime_type);
+        exit(1);
+    }
+    if (res == 0) {
+        loop_remove(transfer->watch);
+        close(fd);
+        if (--from_selection.receiving == 0) {
+            loop_quit();
+        }
+        return;
+    }
+    for (ssize_t written = 0; written < res;) {
+        ssize_t w = write(
+            transfer->file_fd,
+            buffer + written,
+            res - written
+        );
+        if (w < 0) {
+            perror("write");
+            exit(1);
+        }
+        written += w;
+    }
+}
+
+// receives the current selection in each of the wanted types straight
+// into anonymous files, making the first one the payload and the rest
+// its representations; returns the type of the payload
+char *take_selection() {
+    action_on_offered_type = remember_source_type;
+    action_on_selection = remember_source_selection;
+    watch_selection(from_selection.primary);
+    if (from_selection.primary || !use_wlr_data_control) {
+        // we're only sent the selection once we've got the focus
+        action_on_no_keyboard = complain_about_missing_keyboard;
+        popup_tiny_invisible_surface();
+    }
+    while (!from_selection.received) {
+        if (wl_display_dispatch(display) < 0) {
+            perror("wl_display_dispatch");
+            exit(1);
+        }
+    }
+    action_on_offered_type = NULL;
+    action_on_selection = NULL;
+    action_on_no_keyboard = NULL;
+    if (from_selection.offer == NULL) {
+        bail("No selection");
+    }
+
+    // request all the types at once, so that we get a consistent
+    // snapshot of the selection even if it changes midway
+    size_t count = from_selection.offered_count;
+    const char **types = calloc(count, sizeof(char *));
+    int *pipe_fds = calloc(count, sizeof(int));
+    int *write_ends = calloc(count, sizeof(int));
+    size_t active = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!source_type_is_wanted(i)) {
+            continue;
+        }
+        int pipefd[2];
+        if (pipe(pipefd) < 0) {
+            perror("pipe");
+            exit(1);
+        }
+        types[active] = from_selection.offered_types[i];
+        from_selection.receive_f(
+            from_selection.offer,
+            types[active],
+            pipefd[1]
+        );
+        pipe_fds[active] = pipefd[0];
+        write_ends[active] = pipefd[1];
+        active++;
+    }
+    if (active == 0) {
+        bail("None of the requested types are offered");
+    }
+
+    // the popup, if any, stays up for setting the selection
+    wl_display_roundtrip(display);
+    for (size_t i = 0; i < active; i++) {
+        close(write_ends[i]);
+    }
+    free(write_ends);
+
+    // the event loop drains all the pipes concurrently
+    struct source_transfer *transfers = calloc(
+        active,
+        sizeof(struct source_transfer)
+    );
+    for (size_t i = 0; i < active; i++) {
+        transfers[i].mime_type = types[i];
+        transfers[i].pipe_fd = pipe_fds[i];
+        transfers[i].file_fd = create_anonymous_file();
+        if (transfers[i].file_fd < 0) {
+            exit(1);
+        }
+        fcntl(pipe_fds[i], F_SETFL, O_NONBLOCK);
+        transfers[i].watch = loop_add_fd(
+            pipe_fds[i],
+            EPOLLIN,
+            continue_taking,
+            &transfers[i]
+        );
+    }
+    free(pipe_fds);
+    from_selection.receiving = active;
+    if (loop_run(display) < 0) {
+        perror("wl_display_dispatch");
+        exit(1);
+    }
+
+    file_to_copy_fd = transfers[0].file_fd;
+    file_to_copy_is_snapshot = 1;
+    fstat(file_to_copy_fd, &file_to_copy_stat);
+    // offered in reverse order of adding them
+    for (size_t i = active - 1; i > 0; i--) {
+        add_representation(types[i], transfers[i].file_fd);
+    }
+    free(transfers);
+    char *mime_type = strdup(types[0]);
+    free(types);
+    stats_phase("ingest");
+    return mime_type;
+}
+
+// which way --mirror propagates the changes
+enum mirror_direction {
+    MIRROR_NONE,
+    MIRROR_TO_CLIPBOARD,
+    MIRROR_TO_PRIMARY,
+    MIRROR_BOTH
+};
+
+enum mirror_direction mirror_direction = MIRROR_NONE;
+
+// the primary selection keeps changing while text is being
+// selected, so only mirror it once it has settled down
+#define PRIMARY_SETTLE_TIME_NS (300 * 1000 * 1000ull)
+
+void start_mirroring() {
+#ifdef HAVE_WLR_DATA_CONTROL
+    if (use_wlr_data_control) {
+        struct mirror_device *device = mirror_add_device(
+            display,
+            data_control_manager,
+            data_control_device
+        );
+        struct mirror_endpoint *regular = mirror_endpoint(device, 0);
+        struct mirror_endpoint *primary = mirror_endpoint(device, 1);
+        if (primary != NULL) {
+            if (mirror_direction != MIRROR_TO_PRIMARY) {
+                mirror_link(primary, regular, PRIMARY_SETTLE_TIME_NS);
+            }
+            if (mirror_direction != MIRROR_TO_CLIPBOARD) {
+                mirror_link(regular, primary, 0);
+            }
+            return;
+        }
+    }
+#endif
+    bail("Mirroring requires wlr-data-control version 2 support");
+}
+
+// bridges the selection (or the primary selection) of our display with
+// the same selection on each of the given ones, propagating the changes
+// between all of them
+void start_bridging(char * const *display_names, int primary) {
+#ifdef HAVE_WLR_DATA_CONTROL
+    if (use_wlr_data_control) {
+        size_t count = 1;
+        for (char * const *name = display_names; *name != NULL; name++) {
+            count++;
+        }
+        struct mirror_endpoint **endpoints = calloc(
+            count,
+            sizeof(struct mirror_endpoint *)
+        );
+        struct mirror_device *device = mirror_add_device(
+            display,
+            data_control_manager,
+            data_control_device
+        );
+        endpoints[0] = mirror_endpoint(device, primary);
+        if (endpoints[0] == NULL) {
+            bail("Bridging primary selections requires wlr-data-control v2");
+        }
+        for (size_t i = 1; i < count; i++) {
+            device = mirror_connect(display_names[i - 1]);
+            if (device != NULL) {
+                endpoints[i] = mirror_endpoint(device, primary);
+            }
+            if (endpoints[i] == NULL) {
+                fprintf(stderr, "Can't bridge with %s\n", display_names[i - 1]);
+                exit(1);
+            }
+        }
+
+        uint64_t settle_time = primary ? PRIMARY_SETTLE_TIME_NS : 0;
+        for (size_t i = 0; i < count; i++) {
+            for (size_t j = 0; j < count; j++) {
+                if (i != j) {
+                    mirror_link(endpoints[i], endpoints[j], settle_time);
+                }
+            }
+        }
+        free(endpoints);
+        return;
+    }
+#endif
+    bail("Bridging requires wlr-data-control support");
+}
+
 void print_usage(FILE *f, const char *argv0) {
     fprintf(
         f,
         "Usage:\n"
         "\t%s [options] text to copy\n"
-        "\t%s [options] < file-to-copy\n\n"
+        "\t%s [options] < file-to-copy\n"
+        "\t%s [options] --files file...\n"
+        "\t%s [options] --file file\n"
+        "\t%s [options] --from-selection\n"
+        "\t%s [options] --mirror[=direction]\n"
+        "\t%s [options] --bridge display...\n\n"
         "Copy content to the Wayland clipboard.\n\n"
         "Options:\n"
         "\t-o, --paste-once\tOnly serve one paste request and then exit.\n"
         "\t-f, --foreground\tStay in the foreground instead of forking.\n"
         "\t-c, --clear\t\tInstead of copying anything, clear the clipboard.\n"
         "\t-p, --primary\t\tUse the \"primary\" clipboard.\n"
-        "\t-n, --trim-newline\tDo not copy the trailing newline character.\n"
+        "\t-n, --trim-newline\tDo not copy the trailing newline of text.\n"
+        "\t--trim-whitespace\t"
+        "Remove whitespace from the ends of lines.\n"
+        "\t--line-endings lf|crlf\t"
+        "Convert the line endings.\n"
+        "\t--strip-nul\t\tRemove NUL characters.\n"
+        "\t--expand-tabs[=width]\t"
+        "Convert tabs into spaces.\n"
+        "\t--files\t\t\tCopy the given files rather than the text.\n"
+        "\t--file path\t\tCopy the contents of a file in place.\n"
+        "\t--from-selection\t"
+        "Take over the clipboard content itself.\n"
+        "\t--primary-source\t"
+        "Take over the \"primary\" clipboard content instead.\n"
+        "\t--mirror[=direction]\t"
+        "Keep mirroring one clipboard into the other.\n"
+        "\t--bridge\t\tShare the clipboard with the given displays.\n"
+        "\t--if-changed\t\t"
+        "Do nothing if the same content is already copied.\n"
         "\t-t, --type mime/type\t"
         "Override the inferred MIME type for the content.\n"
         "\t-s, --seat seat-name\t"
         "Pick the seat to work with.\n"
+        "\t--ready-fd fd\t\t"
+        "Write a newline to fd once the clipboard is set.\n"
+        "\t--offer-meta\t\t"
+        "Also offer the size and the hash of the content.\n"
+        "\t--stats[=fd:n]\t\tReport timing and transfer stats as JSON.\n"
+        "\t--metrics-file path\t"
+        "Keep counters about served pastes in this file.\n"
         "\t-v, --version\t\tDisplay version info.\n"
         "\t-h, --help\t\tDisplay this message.\n"
         "Mandatory arguments to long options are mandatory"
         " for short options too.\n\n"
         "See wl-clipboard(1) for more details.\n",
         argv0,
+        argv0,
+        argv0,
+        argv0,
+        argv0,
+        argv0,
         argv0
     );
 }
 
+// rather than silently ignoring -n and the like
+void warn_not_normalizing(const char *mime_type) {
+    if (normalize_options_active(&normalize)) {
+        fprintf(stderr, "Not normalizing %s content as text\n", mime_type);
+    }
+}
+
+// how long the process that was started waits for the child to set
+// the selection, which can take forever when no surface of ours ever
+// gets the keyboard focus
+#define READY_TIMEOUT_MS (5 * 1000)
+
+void go_to_background() {
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid > 0) {
+        // leave the child running in the background, but only exit
+        // in the parent once the child has set the selection
+        close(pipefd[1]);
+        struct pollfd pollfd = { .fd = pipefd[0], .events = POLLIN };
+        int ready;
+        do {
+            ready = poll(&pollfd, 1, READY_TIMEOUT_MS);
+        } while (ready < 0 && errno == EINTR);
+        if (ready == 0) {
+            // the child keeps trying in the background
+            fprintf(stderr, "Still setting the clipboard in the background\n");
+            exit(0);
+        }
+        char c;
+        ssize_t res;
+        do {
+            res = read(pipefd[0], &c, 1);
+        } while (res < 0 && errno == EINTR);
+        if (res == 1) {
+            exit(0);
+        }
+        // the child has exited without setting it,
+        // like it does when the content is unchanged
+        int status;
+        if (waitpid(pid, &status, 0) == pid && WIFEXITED(status)) {
+            exit(WEXITSTATUS(status));
+        }
+        exit(1);
+    }
+    close(pipefd[0]);
+    ready_pipe_fd = pipefd[1];
+    // don't keep the pipes we might have been started with open, or
+    // whoever is reading our output would be waiting for us to exit
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        if (stats_fd != STDOUT_FILENO) {
+            dup2(null_fd, STDOUT_FILENO);
+        }
+        close(null_fd);
+    }
+}
+
+// values for long options that don't have a short form
+enum {
+    OPT_IF_CHANGED = 0x100,
+    OPT_STATS,
+    OPT_METRICS_FILE,
+    OPT_TRIM_WHITESPACE,
+    OPT_LINE_ENDINGS,
+    OPT_STRIP_NUL,
+    OPT_EXPAND_TABS,
+    OPT_FILES,
+    OPT_FILE,
+    OPT_FROM_SELECTION,
+    OPT_PRIMARY_SOURCE,
+    OPT_MIRROR,
+    OPT_BRIDGE,
+    OPT_READY_FD,
+    OPT_OFFER_META
+};
+
 int main(int argc, char * const argv[]) {
 
     if (argc < 1) {
@@ -380,20 +1880,38 @@ int main(int argc, char * const argv[]) {
 
     int stay_in_foreground = 0;
     int clear = 0;
+    int copy_files = 0;
+    int bridge = 0;
     char *mime_type = NULL;
     int primary = 0;
-    int trim_newline = 0;
+
+    stats_enable_from_environment("wl-copy");
 
     static struct option long_options[] = {
         {"version", no_argument, 0, 'v'},
         {"help", no_argument, 0, 'h'},
         {"primary", no_argument, 0, 'p'},
         {"trim-newline", no_argument, 0, 'n'},
+        {"trim-whitespace", no_argument, 0, OPT_TRIM_WHITESPACE},
+        {"line-endings", required_argument, 0, OPT_LINE_ENDINGS},
+        {"strip-nul", no_argument, 0, OPT_STRIP_NUL},
+        {"expand-tabs", optional_argument, 0, OPT_EXPAND_TABS},
+        {"if-changed", no_argument, 0, OPT_IF_CHANGED},
+        {"files", no_argument, 0, OPT_FILES},
+        {"file", required_argument, 0, OPT_FILE},
+        {"from-selection", no_argument, 0, OPT_FROM_SELECTION},
+        {"primary-source", no_argument, 0, OPT_PRIMARY_SOURCE},
+        {"mirror", optional_argument, 0, OPT_MIRROR},
+        {"bridge", no_argument, 0, OPT_BRIDGE},
+        {"ready-fd", required_argument, 0, OPT_READY_FD},
+        {"offer-meta", no_argument, 0, OPT_OFFER_META},
         {"paste-once", no_argument, 0, 'o'},
         {"foreground", no_argument, 0, 'f'},
         {"clear", no_argument, 0, 'c'},
         {"type", required_argument, 0, 't'},
         {"seat", required_argument, 0, 's'},
+        {"stats", optional_argument, 0, OPT_STATS},
+        {"metrics-file", required_argument, 0, OPT_METRICS_FILE},
         {0, 0, 0, 0}
     };
     const char *opts = "vhpnofct:s:";
@@ -411,7 +1929,59 @@ int main(int argc, char * const argv[]) {
             primary = 1;
             break;
         case 'n':
-            trim_newline = 1;
+            normalize.trim_final_newline = 1;
+            break;
+        case OPT_TRIM_WHITESPACE:
+            normalize.trim_whitespace = 1;
+            break;
+        case OPT_LINE_ENDINGS:
+            if (!parse_line_endings(optarg, &normalize.line_endings)) {
+                bail("Line endings must be lf or crlf");
+            }
+            break;
+        case OPT_STRIP_NUL:
+            normalize.strip_nul = 1;
+            break;
+        case OPT_EXPAND_TABS:
+            if (!parse_tab_width(optarg, &normalize.tab_width)) {
+                bail("Invalid tab width");
+            }
+            break;
+        case OPT_IF_CHANGED:
+            if_changed.enabled = 1;
+            break;
+        case OPT_FILES:
+            copy_files = 1;
+            break;
+        case OPT_FILE:
+            file_to_copy = optarg;
+            break;
+        case OPT_FROM_SELECTION:
+            from_selection.enabled = 1;
+            break;
+        case OPT_PRIMARY_SOURCE:
+            from_selection.enabled = 1;
+            from_selection.primary = 1;
+            break;
+        case OPT_MIRROR:
+            if (optarg == NULL || strcmp(optarg, "to-clipboard") == 0) {
+                mirror_direction = MIRROR_TO_CLIPBOARD;
+            } else if (strcmp(optarg, "to-primary") == 0) {
+                mirror_direction = MIRROR_TO_PRIMARY;
+            } else if (strcmp(optarg, "both") == 0) {
+                mirror_direction = MIRROR_BOTH;
+            } else {
+                bail("Invalid mirror direction");
+            }
+            break;
+        case OPT_BRIDGE:
+            bridge = 1;
+            break;
+        case OPT_READY_FD:
+            set_ready_fd(optarg);
+            break;
+        case OPT_OFFER_META:
+            offer_meta = 1;
             break;
         case 'o':
             paste_once = 1;
@@ -423,11 +1993,25 @@ int main(int argc, char * const argv[]) {
             clear = 1;
             break;
         case 't':
+            free(mime_type);
             mime_type = strdup(optarg);
+            // with --from-selection, these pick the types to take
+            from_selection.wanted_types = realloc(
+                from_selection.wanted_types,
+                (from_selection.wanted_count + 1) * sizeof(char *)
+            );
+            from_selection.wanted_types[from_selection.wanted_count++] =
+                strdup(optarg);
             break;
         case 's':
             requested_seat_name = strdup(optarg);
             break;
+        case OPT_STATS:
+            stats_enable("wl-copy", optarg);
+            break;
+        case OPT_METRICS_FILE:
+            metrics_file_path = strdup(optarg);
+            break;
         default:
             // getopt has already printed an error message
             print_usage(stderr, argv[0]);
@@ -435,36 +2019,192 @@ int main(int argc, char * const argv[]) {
         }
     }
 
+    if (clear) {
+        // there will be no paste requests to keep track of
+        metrics_file_path = NULL;
+    }
+
+    // a client that stops reading early
+    // should not make us crash
+    signal(SIGPIPE, SIG_IGN);
+
+    if (mirror_direction != MIRROR_NONE) {
+        if (
+            clear || primary || copy_files || file_to_copy != NULL ||
+            from_selection.enabled || if_changed.enabled || optind < argc
+        ) {
+            bail("--mirror can't be combined with anything to copy");
+        }
+        want_wlr_data_control_primary = 1;
+    }
+    if (bridge) {
+        if (
+            clear || copy_files || file_to_copy != NULL ||
+            from_selection.enabled || if_changed.enabled ||
+            mirror_direction != MIRROR_NONE
+        ) {
+            bail("--bridge can't be combined with anything to copy");
+        }
+        if (optind == argc) {
+            bail("--bridge requires displays to bridge with");
+        }
+        want_wlr_data_control_primary = primary;
+    }
+
     init_wayland_globals();
 
+    if (bridge) {
+        start_bridging(&argv[optind], primary);
+        release_focus_objects();
+        if (!stay_in_foreground) {
+            go_to_background();
+        }
+        notify_ready();
+        loop_run(display);
+        perror("wl_display_dispatch");
+        return 1;
+    }
+
+    if (mirror_direction != MIRROR_NONE) {
+        start_mirroring();
+        release_focus_objects();
+        if (!stay_in_foreground) {
+            go_to_background();
+        }
+        notify_ready();
+        loop_run(display);
+        perror("wl_display_dispatch");
+        return 1;
+    }
+
     if (primary) {
         ensure_has_primary_selection();
     }
 
-    if (!clear) {
+    if (from_selection.enabled && !clear) {
+        if (copy_files || file_to_copy != NULL || optind < argc) {
+            bail("--from-selection doesn't take anything else to copy");
+        }
+        if (normalize_options_active(&normalize) || if_changed.enabled) {
+            bail("--from-selection copies the content as is");
+        }
+        if (from_selection.primary) {
+            ensure_has_primary_selection();
+        }
+        // the types asked for with -t are in from_selection.wanted_types
+        free(mime_type);
+        mime_type = take_selection();
+    } else if (file_to_copy != NULL && !clear) {
+        if (copy_files || optind < argc) {
+            bail("--file takes exactly one file to copy");
+        }
+        if (normalize_options_active(&normalize)) {
+            bail("Text normalization can't be combined with --file");
+        }
+        // serve the file where it is, rather than copying it
+        file_to_copy_fd = open_file_snapshot(
+            file_to_copy,
+            &file_to_copy_is_snapshot
+        );
+        if (
+            file_to_copy_fd < 0 ||
+            fstat(file_to_copy_fd, &file_to_copy_stat) < 0
+        ) {
+            perror(file_to_copy);
+            exit(1);
+        }
+        if (!S_ISREG(file_to_copy_stat.st_mode)) {
+            fprintf(stderr, "%s is not a regular file\n", file_to_copy);
+            exit(1);
+        }
+        stats_phase("ingest");
+        if (mime_type == NULL) {
+            mime_type = infer_mime_type_from_contents(file_to_copy);
+        }
+    } else if (copy_files && !clear) {
+        if (optind == argc) {
+            bail("--files requires paths to copy");
+        }
+        data_to_copy = &argv[optind];
+        copy_file_references();
+        if (mime_type == NULL) {
+            mime_type = strdup("text/uri-list");
+        }
+    } else if (!clear) {
+        // never mangle binary content with text normalization; unless
+        // the type is given, stdin has to be copied before its type can
+        // be inferred, so in that case it gets normalized afterwards
+        struct normalize_options as_is = { 0 };
+        int normalize_later = 0;
+        if (mime_type != NULL && !mime_type_is_text(mime_type)) {
+            warn_not_normalizing(mime_type);
+            normalize = as_is;
+        } else if (mime_type == NULL && optind == argc) {
+            normalize_later = normalize_options_active(&normalize);
+        }
         if (optind < argc) {
             // copy our command-line args
             data_to_copy = &argv[optind];
+            join_data_to_copy();
         } else {
             // copy stdin
-            temp_file_to_copy = dump_stdin_into_a_temp_file();
-            if (trim_newline) {
-                trim_trailing_newline(temp_file_to_copy);
-            }
+            temp_file_to_copy = dump_stdin_into_a_temp_file(
+                normalize_later ? &as_is : &normalize
+            );
             if (mime_type == NULL) {
                 mime_type = infer_mime_type_from_contents(temp_file_to_copy);
             }
+            if (
+                normalize_later &&
+                (mime_type == NULL || mime_type_is_text(mime_type))
+            ) {
+                normalize_file(temp_file_to_copy, &normalize);
+            } else if (normalize_later) {
+                warn_not_normalizing(mime_type);
+            }
+            // from now on, it's served the same way as --file
+            file_to_copy_fd = open(temp_file_to_copy, O_RDONLY);
+            if (file_to_copy_fd < 0) {
+                perror("open");
+                exit(1);
+            }
+            file_to_copy_is_snapshot = 1;
+            fstat(file_to_copy_fd, &file_to_copy_stat);
+            stats_phase("ingest");
         }
     }
 
-    if (!stay_in_foreground && !clear) {
-        if (fork() != 0) {
-            // exit in the parent, but leave the
-            // child running in the background
-            exit(0);
+    if (!clear) {
+        if (mime_type != NULL) {
+            content_type = strdup(mime_type);
+        } else {
+            content_type = strdup(text_plain_utf8);
         }
+        converters = load_converters();
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        copied_at_ms = now.tv_sec * 1000ull + now.tv_nsec / 1000000;
+    }
+
+    if (if_changed.enabled && !clear) {
+        hash_payload();
+        if_changed.type_to_compare = strdup(content_type);
+        action_on_offered_type = remember_offered_type;
+        action_on_selection = remember_selection;
+        watch_selection(primary);
     }
 
+    if (!stay_in_foreground && !clear) {
+        go_to_background();
+    }
+
+    // clean up after ourselves instead of leaving the temp file behind
+    loop_add_signal(SIGTERM, handle_termination);
+    loop_add_signal(SIGINT, handle_termination);
+    loop_add_signal(SIGHUP, handle_termination);
+    // converter commands exiting
+    loop_add_signal(SIGCHLD, reap_converters);
+
     if (!primary) {
         init_selection(mime_type);
     } else {
@@ -476,7 +2216,7 @@ int main(int argc, char * const argv[]) {
         exit(0);
     }
 
-    while (wl_display_dispatch(display) >= 0);
+    loop_run(display);
 
     perror("wl_display_dispatch");
     return 1;
@@ -23,8 +23,26 @@ struct {
     char *inferred_type;
     int no_newline;
     int list_types;
+    int all;
+    char *output_dir;
+    off_t max_type_size;
+    off_t max_total_size;
+    int bounded;
+    off_t range_start;
+    off_t range_length;
+    int hash;
+    int if_changed;
+    uint64_t known_fingerprint;
+    int cache;
+    int primary;
+    struct normalize_options normalize;
 } options;
 
+struct {
+    char **types;
+    size_t count;
+} offered_types;
+
 struct {
     int explicit_available;
     int inferred_available;
@@ -33,11 +51,19 @@ struct {
     char *having_explicit_as_prefix;
     char *any_text;
     char *any;
+    // the description wl-copy --offer-meta offers
+    int meta_available;
 } available_types;
 
 void do_process_offer(const char *offered_type) {
     if (options.list_types) {
         printf("%s\n", offered_type);
+    } else if (options.all) {
+        offered_types.types = realloc(
+            offered_types.types,
+            (offered_types.count + 1) * sizeof(char *)
+        );
+        offered_types.types[offered_types.count++] = strdup(offered_type);
     } else {
         if (
             options.explicit_type != NULL &&
@@ -45,6 +71,11 @@ void do_process_offer(const char *offered_type) {
         ) {
             available_types.explicit_available = 1;
         }
+        if (strcmp(offered_type, clipboard_meta_type) == 0) {
+            // not something to paste unless asked for explicitly
+            available_types.meta_available = 1;
+            return;
+        }
         if (
             options.inferred_type != NULL &&
             strcmp(offered_type, options.inferred_type) == 0
@@ -155,236 +186,597 @@ void free_types() {
     free(options.inferred_type);
 }
 
-void do_paste
+struct transfer {
+    const char *mime_type;
+    int pipe_fd;
+    int output_fd;
+    off_t size;
+    uint64_t start;
+    struct loop_watch *watch;
+};
+
+// the --all transfers, drained concurrently on the event loop
+struct {
+    struct transfer *transfers;
+    size_t count;
+    size_t pending;
+    off_t total_size;
+} paste_all;
+
+// turns a MIME type into a file name by replacing slashes
+// with underscores; returns NULL if that wouldn't be safe
+char *file_name_for_type(const char *mime_type) {
+    if (
+        mime_type[0] == 0 ||
+        strcmp(mime_type, ".") == 0 ||
+        strcmp(mime_type, "..") == 0
+    ) {
+        return NULL;
+    }
+    char *name = strdup(mime_type);
+    for (char *ptr = name; *ptr != 0; ptr++) {
+        if (*ptr == '/') {
+            *ptr = '_';
+        }
+    }
+    return name;
+}
+
+// different types can end up with the same name, such as a/b and
+// a_b; the later ones get a number appended so that they don't
+// overwrite each other
+char *make_name_unique(char *name, char **taken, size_t taken_count) {
+    char *candidate = strdup(name);
+    for (int number = 2;; number++) {
+        int clash = 0;
+        for (size_t i = 0; i < taken_count && !clash; i++) {
+            clash = strcmp(taken[i], candidate) == 0;
+        }
+        if (!clash) {
+            free(name);
+            return candidate;
+        }
+        free(candidate);
+        size_t size = strlen(name) + 16;
+        candidate = malloc(size);
+        snprintf(candidate, size, "%s.%d", name, number);
+    }
+}
+
+void finish_transfer(struct transfer *transfer) {
+    trace_probe(paste_end, transfer->mime_type, transfer->size);
+    stats_transfer(transfer->mime_type, transfer->size, transfer->start);
+    if (transfer->watch != NULL) {
+        loop_remove(transfer->watch);
+        transfer->watch = NULL;
+    }
+    close(transfer->pipe_fd);
+    close(transfer->output_fd);
+    transfer->pipe_fd = -1;
+}
+
+void end_transfer(struct transfer *transfer, int truncated) {
+    if (truncated) {
+        fprintf(
+            stderr,
+            "Content of type %s was truncated\n",
+            transfer->mime_type
+        );
+    }
+    // closing the pipe early makes the
+    // source get EPIPE and stop sending
+    finish_transfer(transfer);
+    if (--paste_all.pending == 0) {
+        exit(0);
+    }
+}
+
+void continue_pasting(void *data, int fd, uint32_t events) {
+    struct transfer *transfer = data;
+    char buffer[64 * 1024];
+    size_t to_read = sizeof(buffer);
+    if (options.max_type_size > 0) {
+        off_t left = options.max_type_size - transfer->size;
+        if ((off_t) to_read > left) {
+            to_read = left;
+        }
+    }
+    if (options.max_total_size > 0) {
+        off_t left = options.max_total_size - paste_all.total_size;
+        if ((off_t) to_read > left) {
+            to_read = left;
+        }
+    }
+    if (to_read == 0) {
+        // out of room; whether there's more to it only shows
+        // once the source either sends more or closes the pipe
+        ssize_t res = read(fd, buffer, 1);
+        if (res < 0 && (errno == EINTR || errno == EAGAIN)) {
+            return;
+        }
+        end_transfer(transfer, res > 0);
+        return;
+    }
+    ssize_t res = read(fd, buffer, to_read);
+    if (res < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
+    if (res <= 0) {
+        if (res < 0) {
+            perror("read");
+        }
+        end_transfer(transfer, 0);
+        return;
+    }
+    for (ssize_t written = 0; written < res;) {
+        ssize_t w = write(
+            transfer->output_fd,
+            buffer + written,
+            res - written
+        );
+        if (w < 0) {
+            perror("write");
+            exit(1);
+        }
+        written += w;
+    }
+    transfer->size += res;
+    paste_all.total_size += res;
+}
+
+void do_paste_all
 (
     void *offer,
     void (*receive_f)(void *offer, const char *mime_type, int fd)
 ) {
-    if (offer == NULL) {
-        bail("No selection");
-    }
+    stats_phase("offer");
 
-    if (options.list_types) {
-        exit(0);
+    if (mkdir(options.output_dir, 0777) < 0 && errno != EEXIST) {
+        perror("mkdir");
+        exit(1);
     }
-
-    const char *mime_type = mime_type_to_request();
-    // never append a newline character to binary content
-    if (!mime_type_is_text(mime_type)) {
-        options.no_newline = 1;
+    int dir_fd = open(options.output_dir, O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0) {
+        perror("open output directory");
+        exit(1);
     }
 
-    int pipefd[2];
-    pipe(pipefd);
+    // we only care about this one selection
+    action_on_selection = NULL;
 
-    receive_f(offer, mime_type, pipefd[1]);
+    // request all the types at once, so that we get a consistent
+    // snapshot of the selection even if it changes midway
+    size_t count = offered_types.count;
+    struct transfer *transfers = calloc(count, sizeof(struct transfer));
+    int *write_ends = calloc(count, sizeof(int));
+    char **names = calloc(count, sizeof(char *));
+    size_t active = 0;
+    for (size_t i = 0; i < count; i++) {
+        const char *mime_type = offered_types.types[i];
+        char *name = file_name_for_type(mime_type);
+        if (name == NULL) {
+            continue;
+        }
+        name = make_name_unique(name, names, active);
+        int output_fd = openat(
+            dir_fd,
+            name,
+            O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
+            0666
+        );
+        if (output_fd < 0) {
+            free(name);
+            perror("open output file");
+            continue;
+        }
+        int pipefd[2];
+        pipe(pipefd);
+        transfers[active].start = stats_now();
+        trace_probe(paste_start, mime_type, pipefd[0]);
+        receive_f(offer, mime_type, pipefd[1]);
+        write_ends[active] = pipefd[1];
+        names[active] = name;
+        transfers[active].mime_type = mime_type;
+        transfers[active].pipe_fd = pipefd[0];
+        transfers[active].output_fd = output_fd;
+        active++;
+    }
+    close(dir_fd);
+    for (size_t i = 0; i < active; i++) {
+        free(names[i]);
+    }
+    free(names);
 
-    free_types();
     destroy_popup_surface();
-
     wl_display_roundtrip(display);
+    for (size_t i = 0; i < active; i++) {
+        close(write_ends[i]);
+    }
+    free(write_ends);
 
-    if (fork() == 0) {
-        dup2(pipefd[0], STDIN_FILENO);
-        close(pipefd[0]);
-        close(pipefd[1]);
-        execlp("cat", "cat", NULL);
-        perror("exec cat");
-        exit(1);
+    if (active == 0) {
+        exit(0);
     }
-    close(pipefd[0]);
-    close(pipefd[1]);
-    wait(NULL);
-    if (!options.no_newline) {
-        write(STDOUT_FILENO, "\n", 1);
+
+    // the event loop drains all the pipes concurrently from here
+    paste_all.transfers = transfers;
+    paste_all.count = active;
+    paste_all.pending = active;
+    for (size_t i = 0; i < active; i++) {
+        transfers[i].watch = loop_add_fd(
+            transfers[i].pipe_fd,
+            EPOLLIN,
+            continue_pasting,
+            &transfers[i]
+        );
     }
-    exit(0);
 }
 
-void data_offer_offer
-(
-    void *data,
-    struct wl_data_offer *data_offer,
-    const char *offered_mime_type
-) {
-    do_process_offer(offered_mime_type);
+// pastes the data while computing its fingerprint
+int write_to_stdout(void *data, const char *buffer, size_t size) {
+    for (size_t written = 0; written < size;) {
+        ssize_t res = write(STDOUT_FILENO, buffer + written, size - written);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res < 0) {
+            if (errno != EPIPE) {
+                perror("write");
+            }
+            return 0;
+        }
+        written += res;
+    }
+    return 1;
 }
 
-const struct wl_data_offer_listener data_offer_listener = {
-    .offer = data_offer_offer
-};
+// pastes the data converting it on the way: STRING is Latin-1 by X11
+// convention, so unless asked for the raw bytes, it's pasted as UTF-8
+// like every other text type, and then it goes through the requested
+// normalization; returns the number of bytes received
+off_t paste_converted(int fd, int from_latin1) {
+    struct normalizer *normalizer = NULL;
+    if (normalize_options_active(&options.normalize)) {
+        normalizer = normalizer_create(
+            &options.normalize,
+            write_to_stdout,
+            NULL
+        );
+    }
 
-void data_device_data_offer
-(
-    void *data,
-    struct wl_data_device *data_device,
-    struct wl_data_offer *data_offer
-) {
-    wl_data_offer_add_listener(data_offer, &data_offer_listener, NULL);
+    char in[32 * 1024], out[2 * sizeof(in)];
+    off_t total = 0;
+    while (1) {
+        ssize_t res = read(fd, in, sizeof(in));
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res < 0) {
+            perror("read");
+        }
+        if (res <= 0) {
+            break;
+        }
+        total += res;
+
+        const char *data = in;
+        size_t size = res;
+        if (from_latin1) {
+            size = latin1_to_utf8(in, res, out);
+            data = out;
+        }
+        int succeeded;
+        if (normalizer != NULL) {
+            succeeded = normalizer_feed(normalizer, data, size);
+        } else {
+            succeeded = write_to_stdout(NULL, data, size);
+        }
+        if (!succeeded) {
+            break;
+        }
+    }
+
+    if (normalizer != NULL) {
+        normalizer_finish(normalizer);
+    }
+    return total;
+}
+
+void append_newline() {
+    if (options.no_newline || options.bounded) {
+        return;
+    }
+    if (options.normalize.line_endings == LINE_ENDINGS_CRLF) {
+        write(STDOUT_FILENO, "\r\n", 2);
+    } else {
+        write(STDOUT_FILENO, "\n", 1);
+    }
 }
 
-void data_device_selection
+void do_paste_hashed
 (
-    void *data,
-    struct wl_data_device *data_device,
-    struct wl_data_offer *data_offer
+    const char *mime_type,
+    int fd,
+    uint64_t start,
+    int from_latin1
 ) {
-    do_paste(
-        data_offer,
-        (void (*)(void *, const char *, int)) wl_data_offer_receive
-    );
-}
+    // unless we only need to print the fingerprint, we have to hold
+    // on to the data until we know whether it has changed
+    int copy_fd = -1;
+    if (!options.hash) {
+        copy_fd = create_anonymous_file();
+    }
 
-const struct wl_data_device_listener data_device_listener = {
-    .data_offer = data_device_data_offer,
-    .selection = data_device_selection
-};
+    off_t limit = -1;
+    if (options.bounded) {
+        if (discard_fd_data(fd, options.range_start) < options.range_start) {
+            close(fd);
+            fd = -1;
+        }
+        limit = options.range_length;
+    }
 
-#ifdef HAVE_GTK_PRIMARY_SELECTION
+    struct hash_state state;
+    hash_init(&state);
+    off_t size = 0;
+    if (fd >= 0) {
+        size = hash_fd_data(fd, &state, copy_fd, limit);
+        close(fd);
+    }
+    trace_probe(paste_end, mime_type, size);
+    stats_transfer(mime_type, size, start);
+    uint64_t hash = hash_digest(&state);
 
-void gtk_primary_selection_offer_offer
-(
-    void *data,
-    struct gtk_primary_selection_offer *gtk_primary_selection_offer,
-    const char *offered_mime_type
-) {
-    do_process_offer(offered_mime_type);
-}
+    if (options.if_changed && hash == options.known_fingerprint) {
+        exit(2);
+    }
 
-const struct gtk_primary_selection_offer_listener
-gtk_primary_selection_offer_listener = {
-    .offer = gtk_primary_selection_offer_offer
-};
+    if (options.hash) {
+        char fingerprint[FINGERPRINT_LENGTH + 1];
+        format_fingerprint(hash, fingerprint);
+        printf("%s\n", fingerprint);
+        exit(0);
+    }
 
-void gtk_primary_selection_device_data_offer
-(
-    void *data,
-    struct gtk_primary_selection_device *gtk_primary_selection_device,
-    struct gtk_primary_selection_offer *gtk_primary_selection_offer
-) {
-    gtk_primary_selection_offer_add_listener(
-        gtk_primary_selection_offer,
-        &gtk_primary_selection_offer_listener,
-        NULL
-    );
+    lseek(copy_fd, 0, SEEK_SET);
+    if (from_latin1 || normalize_options_active(&options.normalize)) {
+        paste_converted(copy_fd, from_latin1);
+    } else {
+        copy_fd_range(copy_fd, STDOUT_FILENO, 0, -1);
+    }
+    append_newline();
+    exit(0);
 }
 
-void gtk_primary_selection_device_selection
+// reads what wl-copy --offer-meta has to say about the content
+// of the given type; returns 0 if it has nothing to say
+int fetch_meta
 (
-    void *data,
-    struct gtk_primary_selection_device *gtk_primary_selection_device,
-    struct gtk_primary_selection_offer *gtk_primary_selection_offer
+    void *offer,
+    void (*receive_f)(void *offer, const char *mime_type, int fd),
+    const char *mime_type,
+    struct clipboard_meta *meta
 ) {
-    do_paste(
-        gtk_primary_selection_offer,
-        (void (*)(void *, const char *, int))
-              gtk_primary_selection_offer_receive
-    );
-}
+    if (!available_types.meta_available) {
+        return 0;
+    }
+    int pipefd[2];
+    if (pipe(pipefd) < 0) {
+        return 0;
+    }
+    receive_f(offer, clipboard_meta_type, pipefd[1]);
+    wl_display_flush(display);
+    close(pipefd[1]);
 
-const struct gtk_primary_selection_device_listener
-gtk_primary_selection_device_listener = {
-    .data_offer = gtk_primary_selection_device_data_offer,
-    .selection = gtk_primary_selection_device_selection
-};
+    char buffer[CLIPBOARD_META_MAX_SIZE];
+    size_t length = 0;
+    while (length < sizeof(buffer)) {
+        ssize_t res = read(pipefd[0], buffer + length, sizeof(buffer) - length);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            break;
+        }
+        length += res;
+    }
+    close(pipefd[0]);
+    if (length == sizeof(buffer)) {
+        return 0;
+    }
+    if (!parse_clipboard_meta(buffer, length, meta)) {
+        return 0;
+    }
+    return clipboard_meta_has_type(meta, mime_type);
+}
 
+// lets the filesystem allocate the output file in one go
+void preallocate_output(off_t size) {
+#ifdef HAVE_FALLOCATE
+    struct stat st;
+    if (size <= 0 || fstat(STDOUT_FILENO, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return;
+    }
+    off_t offset = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+    if (offset >= 0) {
+        // keep the size, so that nothing is left over should we
+        // end up getting less data than we have been promised
+        fallocate(STDOUT_FILENO, FALLOC_FL_KEEP_SIZE, offset, size);
+    }
 #endif
+}
 
-#ifdef HAVE_WP_PRIMARY_SELECTION
+// knowing the size and the fingerprint of the content up front lets
+// us skip the transfer entirely in many cases, and otherwise stream
+// it right to the output instead of holding on to it first
+void use_meta(const struct clipboard_meta *meta, int converting) {
+    off_t expected_size = meta->size;
+    if (options.bounded) {
+        if (options.range_start >= meta->size) {
+            if (!options.hash && !options.if_changed) {
+                // there's nothing in the range
+                append_newline();
+                exit(0);
+            }
+            return;
+        }
+        expected_size -= options.range_start;
+        if (options.range_length >= 0 && options.range_length < expected_size) {
+            expected_size = options.range_length;
+        }
+    } else {
+        if (options.if_changed && meta->hash == options.known_fingerprint) {
+            exit(2);
+        }
+        if (options.hash) {
+            char fingerprint[FINGERPRINT_LENGTH + 1];
+            format_fingerprint(meta->hash, fingerprint);
+            printf("%s\n", fingerprint);
+            exit(0);
+        }
+        // we already know it has changed
+        options.if_changed = 0;
+    }
+    if (!converting && !options.hash && !options.if_changed) {
+        preallocate_output(expected_size);
+    }
+}
 
-void primary_selection_offer_offer
+// gets the content out of the cache, or from its owner storing it in
+// the cache on the way; returns -1 if the cache can't help with it
+int receive_through_cache
 (
-    void *data,
-    struct zwp_primary_selection_offer_v1 *primary_selection_offer,
-    const char *offered_mime_type
+    void *offer,
+    void (*receive_f)(void *offer, const char *mime_type, int fd),
+    const char *mime_type,
+    const struct clipboard_meta *meta
 ) {
-    do_process_offer(offered_mime_type);
-}
+    const char *clipboard = options.primary ? "primary" : "clipboard";
+    int fd = cache_lookup(clipboard, mime_type, meta->hash);
+    if (fd >= 0) {
+        trace_probe(paste_start, mime_type, fd);
+        return fd;
+    }
+    // no need to transfer all of the content for a part of it
+    if (options.bounded || meta->size > CACHE_MAX_ENTRY_SIZE) {
+        return -1;
+    }
+    struct cache_store store;
+    if (!cache_begin(&store)) {
+        return -1;
+    }
 
-const struct zwp_primary_selection_offer_v1_listener
-primary_selection_offer_listener = {
-    .offer = primary_selection_offer_offer
-};
+    int pipefd[2];
+    pipe(pipefd);
+    trace_probe(paste_start, mime_type, pipefd[0]);
+    receive_f(offer, mime_type, pipefd[1]);
+    wl_display_flush(display);
+    close(pipefd[1]);
 
-void primary_selection_device_data_offer
-(
-    void *data,
-    struct zwp_primary_selection_device_v1 *primary_selection_device,
-    struct zwp_primary_selection_offer_v1 *primary_selection_offer
-) {
-    zwp_primary_selection_offer_v1_add_listener(
-        primary_selection_offer,
-        &primary_selection_offer_listener,
-        NULL
-    );
+    struct hash_state state;
+    hash_init(&state);
+    off_t size = hash_fd_data(pipefd[0], &state, store.fd, -1);
+    close(pipefd[0]);
+    // only keep it if it is what we have been told it is
+    if (size == meta->size && hash_digest(&state) == meta->hash) {
+        cache_commit(&store, clipboard, mime_type, meta->hash);
+    } else {
+        cache_abort(&store);
+    }
+    lseek(store.fd, 0, SEEK_SET);
+    return store.fd;
 }
 
-void primary_selection_device_selection
+void do_paste
 (
-    void *data,
-    struct zwp_primary_selection_device_v1 *primary_selection_device,
-    struct zwp_primary_selection_offer_v1 *primary_selection_offer
+    void *offer,
+    void (*receive_f)(void *offer, const char *mime_type, int fd)
 ) {
-    do_paste(
-        primary_selection_offer,
-        (void (*)(void *, const char *, int))
-              zwp_primary_selection_offer_v1_receive
+    if (offer == NULL) {
+        bail("No selection");
+    }
+
+    if (options.list_types) {
+        exit(0);
+    }
+
+    if (options.all) {
+        // the event loop drains the transfers from here
+        do_paste_all(offer, receive_f);
+        return;
+    }
+
+    stats_phase("offer");
+
+    // free_types() below frees the string we pick
+    char *mime_type = strdup(mime_type_to_request());
+    // never append a newline character to binary content,
+    // or mangle it with text normalization
+    if (!mime_type_is_text(mime_type)) {
+        options.no_newline = 1;
+        memset(&options.normalize, 0, sizeof(options.normalize));
+    }
+    int from_latin1 = strcmp(mime_type, "STRING") == 0 && !options.bounded && (
+        options.explicit_type == NULL ||
+        strcmp(options.explicit_type, "STRING") != 0
     );
-}
 
-const struct zwp_primary_selection_device_v1_listener
-primary_selection_device_listener = {
-    .data_offer = primary_selection_device_data_offer,
-    .selection = primary_selection_device_selection
-};
+    struct clipboard_meta meta;
+    int have_meta = fetch_meta(offer, receive_f, mime_type, &meta);
+    if (have_meta) {
+        use_meta(
+            &meta,
+            from_latin1 || normalize_options_active(&options.normalize)
+        );
+    }
 
-#endif
+    uint64_t start = stats_now();
+    int fd = -1;
+    int write_end = -1;
+    if (have_meta && options.cache) {
+        fd = receive_through_cache(offer, receive_f, mime_type, &meta);
+    }
+    if (fd < 0) {
+        int pipefd[2];
+        pipe(pipefd);
+        trace_probe(paste_start, mime_type, pipefd[0]);
+        receive_f(offer, mime_type, pipefd[1]);
+        fd = pipefd[0];
+        write_end = pipefd[1];
+    }
 
-#ifdef HAVE_WLR_DATA_CONTROL
-void data_control_offer_offer
-(
-    void *data,
-    struct zwlr_data_control_offer_v1 *data_offer,
-    const char *offered_mime_type
-) {
-    do_process_offer(offered_mime_type);
-}
+    free_types();
+    destroy_popup_surface();
 
-const struct zwlr_data_control_offer_v1_listener data_control_offer_listener = {
-    .offer = data_control_offer_offer
-};
+    wl_display_roundtrip(display);
 
-void data_control_device_data_offer
-(
-    void *data,
-    struct zwlr_data_control_device_v1 *data_control_device,
-    struct zwlr_data_control_offer_v1 *data_control_offer
-) {
-    zwlr_data_control_offer_v1_add_listener(
-        data_control_offer,
-        &data_control_offer_listener,
-        NULL
-    );
-}
+    if (write_end >= 0) {
+        close(write_end);
+    }
 
-void data_control_device_selection
-(
-    void *data,
-    struct zwlr_data_control_device_v1 *data_control_device,
-    struct zwlr_data_control_offer_v1 *data_control_offer
-) {
-    do_paste(
-        data_control_offer,
-        (void (*)(void *, const char *, int)) zwlr_data_control_offer_v1_receive
-    );
-}
+    if (options.hash || options.if_changed) {
+        do_paste_hashed(mime_type, fd, start, from_latin1);
+    }
 
-const struct zwlr_data_control_device_v1_listener
-data_control_device_listener = {
-    .data_offer = data_control_device_data_offer,
-    .selection = data_control_device_selection
-};
-#endif
+    off_t size;
+    if (from_latin1 || normalize_options_active(&options.normalize)) {
+        size = paste_converted(fd, from_latin1);
+    } else {
+        size = copy_fd_range(
+            fd,
+            STDOUT_FILENO,
+            options.range_start,
+            options.range_length
+        );
+    }
+    // when pasting a range, closing the pipe before reading all of
+    // the data makes the source get EPIPE and stop sending
+    close(fd);
+    trace_probe(paste_end, mime_type, size);
+    stats_transfer(mime_type, size, start);
+    append_newline();
+    exit(0);
+}
 
 void print_usage(FILE *f, const char *argv0) {
     fprintf(
@@ -395,11 +787,35 @@ void print_usage(FILE *f, const char *argv0) {
         "Options:\n"
         "\t-n, --no-newline\tDo not append a newline character.\n"
         "\t-l, --list-types\tInstead of pasting, list the offered types.\n"
+        "\t-H, --head size\t\tOnly paste the first size bytes.\n"
+        "\t-r, --range start-end\t"
+        "Only paste the bytes from start to end.\n"
+        "\t-x, --hash\t\t"
+        "Instead of pasting, print a fingerprint of the content.\n"
+        "\t--if-changed fingerprint\t"
+        "Only paste if the content has a different fingerprint.\n"
+        "\t--cache\t\t\t"
+        "Reuse the content pasted before while it stays the same.\n"
+        "\t-a, --all\t\tPaste all the offered types at once.\n"
+        "\t-d, --output-dir dir\t"
+        "Save the types pasted with --all into this directory.\n"
+        "\t--max-type-size size\t"
+        "Truncate each type pasted with --all to this size.\n"
+        "\t--max-total-size size\t"
+        "Stop pasting with --all after this many bytes.\n"
+        "\t--trim-whitespace\t"
+        "Remove whitespace from the ends of lines.\n"
+        "\t--line-endings lf|crlf\t"
+        "Convert the line endings.\n"
+        "\t--strip-nul\t\tRemove NUL characters.\n"
+        "\t--expand-tabs[=width]\t"
+        "Convert tabs into spaces.\n"
         "\t-p, --primary\t\tUse the \"primary\" clipboard.\n"
         "\t-t, --type mime/type\t"
         "Override the inferred MIME type for the content.\n"
         "\t-s, --seat seat-name\t"
         "Pick the seat to work with.\n"
+        "\t--stats[=fd:n]\t\tReport timing and transfer stats as JSON.\n"
         "\t-v, --version\t\tDisplay version info.\n"
         "\t-h, --help\t\tDisplay this message.\n"
         "Mandatory arguments to long options are mandatory"
@@ -410,55 +826,63 @@ void print_usage(FILE *f, const char *argv0) {
 }
 
 void init_selection() {
-    if (use_wlr_data_control) {
-#ifdef HAVE_WLR_DATA_CONTROL
-        zwlr_data_control_device_v1_add_listener(
-            data_control_device,
-            &data_control_device_listener,
-            NULL
-        );
-#endif
-    } else {
-        wl_data_device_add_listener(data_device, &data_device_listener, NULL);
+    watch_selection(0);
+    if (!use_wlr_data_control) {
         popup_tiny_invisible_surface();
     }
 }
 
 void init_primary_selection() {
-    ensure_has_primary_selection();
+    watch_selection(1);
+    popup_tiny_invisible_surface();
+}
 
-#ifdef HAVE_WP_PRIMARY_SELECTION
-    if (primary_selection_device != NULL) {
-        zwp_primary_selection_device_v1_add_listener(
-            primary_selection_device,
-            &primary_selection_device_listener,
-            NULL
-        );
-        popup_tiny_invisible_surface();
-        return;
+// parses start-end or start- into the range options
+void parse_range(const char *range) {
+    char *start = strdup(range);
+    char *end = strchr(start, '-');
+    if (end == NULL) {
+        bail("Invalid range");
     }
-#endif
-
-#ifdef HAVE_GTK_PRIMARY_SELECTION
-    if (gtk_primary_selection_device != NULL) {
-        gtk_primary_selection_device_add_listener(
-            gtk_primary_selection_device,
-            &gtk_primary_selection_device_listener,
-            NULL
-        );
-        popup_tiny_invisible_surface();
-        return;
+    *end++ = 0;
+    if (!parse_size(start, &options.range_start)) {
+        bail("Invalid range");
     }
-#endif
+    if (*end == 0) {
+        options.range_length = -1;
+    } else {
+        off_t last;
+        if (!parse_size(end, &last) || last < options.range_start) {
+            bail("Invalid range");
+        }
+        options.range_length = last - options.range_start + 1;
+    }
+    options.bounded = 1;
+    free(start);
 }
 
+// values for long options that don't have a short form
+enum {
+    OPT_MAX_TYPE_SIZE = 0x100,
+    OPT_MAX_TOTAL_SIZE,
+    OPT_IF_CHANGED,
+    OPT_STATS,
+    OPT_TRIM_WHITESPACE,
+    OPT_LINE_ENDINGS,
+    OPT_STRIP_NUL,
+    OPT_EXPAND_TABS,
+    OPT_CACHE
+};
+
 int main(int argc, char * const argv[]) {
 
     if (argc < 1) {
         bail("Empty argv");
     }
 
-    int primary = 0;
+    options.range_length = -1;
+
+    stats_enable_from_environment("wl-paste");
 
     static struct option long_options[] = {
         {"version", no_argument, 0, 'v'},
@@ -466,13 +890,27 @@ int main(int argc, char * const argv[]) {
         {"primary", no_argument, 0, 'p'},
         {"no-newline", no_argument, 0, 'n'},
         {"list-types", no_argument, 0, 'l'},
+        {"head", required_argument, 0, 'H'},
+        {"range", required_argument, 0, 'r'},
+        {"hash", no_argument, 0, 'x'},
+        {"if-changed", required_argument, 0, OPT_IF_CHANGED},
+        {"all", no_argument, 0, 'a'},
+        {"output-dir", required_argument, 0, 'd'},
+        {"max-type-size", required_argument, 0, OPT_MAX_TYPE_SIZE},
+        {"max-total-size", required_argument, 0, OPT_MAX_TOTAL_SIZE},
+        {"trim-whitespace", no_argument, 0, OPT_TRIM_WHITESPACE},
+        {"line-endings", required_argument, 0, OPT_LINE_ENDINGS},
+        {"strip-nul", no_argument, 0, OPT_STRIP_NUL},
+        {"expand-tabs", optional_argument, 0, OPT_EXPAND_TABS},
         {"type", required_argument, 0, 't'},
         {"seat", required_argument, 0, 's'},
+        {"cache", no_argument, 0, OPT_CACHE},
+        {"stats", optional_argument, 0, OPT_STATS},
         {0, 0, 0, 0}
     };
     while (1) {
         int option_index;
-        const char *opts = "vhpnlt:s:";
+        const char *opts = "vhpnlH:r:xad:t:s:";
         int c = getopt_long(argc, argv, opts, long_options, &option_index);
         if (c == -1) {
             break;
@@ -488,7 +926,7 @@ int main(int argc, char * const argv[]) {
             print_usage(stdout, argv[0]);
             exit(0);
         case 'p':
-            primary = 1;
+            options.primary = 1;
             break;
         case 'n':
             options.no_newline = 1;
@@ -496,12 +934,69 @@ int main(int argc, char * const argv[]) {
         case 'l':
             options.list_types = 1;
             break;
+        case 'H':
+            if (!parse_size(optarg, &options.range_length)) {
+                bail("Invalid size");
+            }
+            options.bounded = 1;
+            options.range_start = 0;
+            break;
+        case 'r':
+            parse_range(optarg);
+            break;
+        case 'x':
+            options.hash = 1;
+            break;
+        case OPT_IF_CHANGED:
+            if (!parse_fingerprint(optarg, &options.known_fingerprint)) {
+                bail("Invalid fingerprint");
+            }
+            options.if_changed = 1;
+            break;
+        case 'a':
+            options.all = 1;
+            break;
+        case 'd':
+            options.output_dir = strdup(optarg);
+            break;
+        case OPT_MAX_TYPE_SIZE:
+            if (!parse_size(optarg, &options.max_type_size)) {
+                bail("Invalid size");
+            }
+            break;
+        case OPT_MAX_TOTAL_SIZE:
+            if (!parse_size(optarg, &options.max_total_size)) {
+                bail("Invalid size");
+            }
+            break;
+        case OPT_TRIM_WHITESPACE:
+            options.normalize.trim_whitespace = 1;
+            break;
+        case OPT_LINE_ENDINGS:
+            if (!parse_line_endings(optarg, &options.normalize.line_endings)) {
+                bail("Line endings must be lf or crlf");
+            }
+            break;
+        case OPT_STRIP_NUL:
+            options.normalize.strip_nul = 1;
+            break;
+        case OPT_EXPAND_TABS:
+            if (!parse_tab_width(optarg, &options.normalize.tab_width)) {
+                bail("Invalid tab width");
+            }
+            break;
         case 't':
             options.explicit_type = strdup(optarg);
             break;
         case 's':
             requested_seat_name = strdup(optarg);
             break;
+        case OPT_CACHE:
+            options.cache = 1;
+            break;
+        case OPT_STATS:
+            stats_enable("wl-paste", optarg);
+            break;
         default:
             // getopt has already printed an error message
             print_usage(stderr, argv[0]);
@@ -509,6 +1004,21 @@ int main(int argc, char * const argv[]) {
         }
     }
 
+    if (options.all && options.output_dir == NULL) {
+        bail("--all requires --output-dir");
+    }
+    if (
+        normalize_options_active(&options.normalize) &&
+        (options.all || options.bounded)
+    ) {
+        bail("Text normalization can't be combined with --all or a range");
+    }
+    if (options.cache && options.all) {
+        bail("--cache can't be combined with --all");
+    }
+
+    atexit(stats_report);
+
     char *path = path_for_fd(STDOUT_FILENO);
     if (path != NULL && options.explicit_type == NULL) {
         options.inferred_type = infer_mime_type_from_name(path);
@@ -517,13 +1027,16 @@ int main(int argc, char * const argv[]) {
 
     init_wayland_globals();
 
-    if (!primary) {
+    action_on_offered_type = do_process_offer;
+    action_on_selection = do_paste;
+
+    if (!options.primary) {
         init_selection();
     } else {
         init_primary_selection();
     }
 
-    while (wl_display_dispatch(display) >= 0);
+    loop_run(display);
 
     perror("wl_display_dispatch");
     return 1;
@@ -0,0 +1,268 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+#include "workers.h"
+#include "loop.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#ifdef HAVE_EVENTFD
+#    include <sys/eventfd.h>
+#endif
+
+// more threads than this would just compete for the same content
+#define MAX_WORKERS 4
+// must be a power of two
+#define QUEUE_SIZE 64
+
+struct job {
+    void (*work)(void *data);
+    void (*done)(void *data);
+    void *data;
+    struct job *next_completed;
+};
+
+// the submission queue is a bounded multi-consumer ring, where each
+// slot's sequence number tells whether it's ready to be filled or
+// to be taken (see Dmitry Vyukov's bounded MPMC queue)
+static struct {
+    size_t sequence;
+    struct job *job;
+} slots[QUEUE_SIZE];
+static size_t enqueue_position;
+static size_t dequeue_position;
+// counts the jobs in the queue, for the workers to sleep on
+static sem_t queued;
+
+// the completed jobs, pushed by the workers in a lock-free stack
+// and taken all at once by the loop thread
+static struct job *completed;
+
+// wakes up the loop thread: an eventfd, or the two ends of a pipe
+static int notify_fds[2] = { -1, -1 };
+
+static int initialized = 0;
+static int available = 0;
+static int pending = 0;
+
+static int enqueue(struct job *job) {
+    size_t position = __atomic_load_n(&enqueue_position, __ATOMIC_RELAXED);
+    while (1) {
+        size_t index = position & (QUEUE_SIZE - 1);
+        size_t sequence = __atomic_load_n(
+            &slots[index].sequence,
+            __ATOMIC_ACQUIRE
+        );
+        intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+        if (difference < 0) {
+            // full
+            return 0;
+        }
+        if (difference == 0 && __atomic_compare_exchange_n(
+            &enqueue_position, &position, position + 1,
+            1, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+        )) {
+            slots[index].job = job;
+            __atomic_store_n(
+                &slots[index].sequence,
+                position + 1,
+                __ATOMIC_RELEASE
+            );
+            return 1;
+        }
+        if (difference > 0) {
+            position = __atomic_load_n(&enqueue_position, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static struct job *dequeue() {
+    size_t position = __atomic_load_n(&dequeue_position, __ATOMIC_RELAXED);
+    while (1) {
+        size_t index = position & (QUEUE_SIZE - 1);
+        size_t sequence = __atomic_load_n(
+            &slots[index].sequence,
+            __ATOMIC_ACQUIRE
+        );
+        intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+        if (difference < 0) {
+            // empty
+            return NULL;
+        }
+        if (difference == 0 && __atomic_compare_exchange_n(
+            &dequeue_position, &position, position + 1,
+            1, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+        )) {
+            struct job *job = slots[index].job;
+            __atomic_store_n(
+                &slots[index].sequence,
+                position + QUEUE_SIZE,
+                __ATOMIC_RELEASE
+            );
+            return job;
+        }
+        if (difference > 0) {
+            position = __atomic_load_n(&dequeue_position, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void notify_loop() {
+#ifdef HAVE_EVENTFD
+    uint64_t one = 1;
+    write(notify_fds[1], &one, sizeof(one));
+#else
+    char byte = 0;
+    write(notify_fds[1], &byte, 1);
+#endif
+}
+
+static void *run_worker(void *arg) {
+    while (1) {
+        if (sem_wait(&queued) < 0) {
+            continue;
+        }
+        struct job *job = dequeue();
+        if (job == NULL) {
+            continue;
+        }
+        job->work(job->data);
+
+        struct job *head = __atomic_load_n(&completed, __ATOMIC_RELAXED);
+        do {
+            job->next_completed = head;
+        } while (!__atomic_compare_exchange_n(
+            &completed, &head, job,
+            1, __ATOMIC_RELEASE, __ATOMIC_RELAXED
+        ));
+        notify_loop();
+    }
+    return NULL;
+}
+
+static void dispatch_completions(void *data, int fd, uint32_t events) {
+    // clear the notification; the jobs themselves are on the stack
+    char buffer[64];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {
+        continue;
+    }
+
+    struct job *list = __atomic_exchange_n(
+        &completed,
+        NULL,
+        __ATOMIC_ACQUIRE
+    );
+    // the stack has the most recently completed job on top
+    struct job *ordered = NULL;
+    while (list != NULL) {
+        struct job *next = list->next_completed;
+        list->next_completed = ordered;
+        ordered = list;
+        list = next;
+    }
+    while (ordered != NULL) {
+        struct job *job = ordered;
+        ordered = job->next_completed;
+        pending--;
+        job->done(job->data);
+        free(job);
+    }
+}
+
+static int start_workers() {
+    for (size_t i = 0; i < QUEUE_SIZE; i++) {
+        slots[i].sequence = i;
+    }
+    if (sem_init(&queued, 0, 0) < 0) {
+        return 0;
+    }
+#ifdef HAVE_EVENTFD
+    notify_fds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    notify_fds[1] = notify_fds[0];
+    if (notify_fds[0] < 0) {
+        return 0;
+    }
+#else
+    if (pipe(notify_fds) < 0) {
+        return 0;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(notify_fds[i], F_SETFL, O_NONBLOCK);
+        fcntl(notify_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int count = cpus > MAX_WORKERS ? MAX_WORKERS : cpus > 1 ? cpus : 1;
+
+    // signals are for the loop thread to handle
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int started = 0;
+    for (int i = 0; i < count; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, run_worker, NULL) == 0) {
+            pthread_detach(thread);
+            started++;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (started == 0) {
+        return 0;
+    }
+
+    loop_add_fd(notify_fds[0], EPOLLIN, dispatch_completions, NULL);
+    return 1;
+}
+
+void workers_submit(
+    void (*work)(void *data),
+    void (*done)(void *data),
+    void *data
+) {
+    if (!initialized) {
+        initialized = 1;
+        available = start_workers();
+    }
+
+    struct job *job = malloc(sizeof(struct job));
+    if (available && job != NULL) {
+        job->work = work;
+        job->done = done;
+        job->data = data;
+        if (enqueue(job)) {
+            pending++;
+            sem_post(&queued);
+            return;
+        }
+    }
+    free(job);
+    work(data);
+    done(data);
+}
+
+int workers_pending() {
+    return pending;
+}
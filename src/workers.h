@@ -0,0 +1,45 @@
+/* wl-clipboard
+ *
+ * Copyright © 2019 Sergey Bugaev <bugaevc@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef WL_CLIPBOARD_WORKERS_H
+#define WL_CLIPBOARD_WORKERS_H
+
+// a small pool of threads for CPU-heavy work, such as hashing and
+// converting the content, so that it doesn't hold up the thread that
+// has to keep answering the compositor; the threads are only started
+// once there's work for them
+//
+// jobs are handed over through a bounded lock-free queue, and their
+// completions come back through another one and get dispatched on
+// the event loop; when the queue is full, or no threads could be
+// started, the job runs right away on the calling thread instead
+
+// the work function runs on a worker thread, so it must not touch
+// anything the loop thread might be using at the same time; the done
+// function runs on the loop thread once the work is over; jobs that
+// run at the same time may complete, and get their done function
+// called, in any order
+void workers_submit(
+    void (*work)(void *data),
+    void (*done)(void *data),
+    void *data
+);
+
+// how many jobs have been submitted and haven't completed yet
+int workers_pending(void);
+
+#endif